@@ -0,0 +1,675 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#include "bulk.h"
+
+#define BULK_CHUNK_SIZE (1024 * 1024)
+#define BULK_BUFFERS 32
+#define BULK_QUEUE_DEPTH 16
+#define BULK_MAX_WORKERS 64
+
+/*
+* One buffer of the ring. It is read into while in flight, then waits in
+* its file's ready list until a worker matches it and hands it back.
+*/
+typedef struct SBulkChunk {
+    struct SBulkFile *file;
+    size_t index;
+    size_t requested;
+    size_t got;
+    ssize_t len;
+    char *data;
+    struct SBulkChunk *next;
+} BulkChunk;
+
+/*
+* Chunks of a file are matched in order, by one worker at a time, the
+* match state of the current line carries over from one to the next.
+*/
+typedef struct SBulkFile {
+    int fd;
+    size_t size;
+    size_t chunksCount;
+    size_t submitted;
+    size_t matched;
+    BulkChunk *ready;
+    int busy;
+    int queued;
+    FsmState state;
+    int lineStarted;
+    BulkResult *result;
+    struct SBulkFile *nextQueued;
+} BulkFile;
+
+/*
+* io_uring rings mapped from raw syscalls, or ring -1 to read with pread
+* when io_uring is not available.
+*/
+typedef struct SBulkIo {
+    int ring;
+    void *sqMap;
+    size_t sqMapSize;
+    void *cqMap;
+    size_t cqMapSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned pending;
+    BulkChunk *done;
+} BulkIo;
+
+typedef struct SBulk {
+    const FsmCompiled *compiled;
+    BulkFile *files;
+    size_t filesCount;
+    size_t filesDone;
+    BulkChunk chunks[BULK_BUFFERS];
+    char *buffers;
+    BulkChunk *free;
+    BulkFile *queueHead;
+    BulkFile *queueTail;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t progress;
+    BulkIo io;
+} Bulk;
+
+static int _bulkOpen(Bulk *bulk, BulkFile *file, const char *path);
+static void _bulkReady(Bulk *bulk, BulkChunk *chunk);
+static void *_bulkWorker(void *bulk);
+static void _bulkMatch(Bulk *bulk, BulkFile *file, BulkChunk *chunk);
+static void _bulkEndLine(Bulk *bulk, BulkFile *file);
+static void _bulkIoInit(BulkIo *io, unsigned entries);
+static void _bulkIoDestroy(BulkIo *io);
+static void _bulkIoSubmit(BulkIo *io, BulkChunk *chunk);
+static BulkChunk *_bulkIoWait(BulkIo *io);
+static void _bulkIoRead(BulkIo *io, BulkChunk *chunk);
+static int _bulkAddFile(char ***files, size_t *count, size_t *capacity, const char *path);
+static int _compareFile(const void *a, const void *b);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+/*
+* The regular files of a directory, sorted by name, or the paths listed
+* one per line in a file.
+*/
+char **bulkListFiles(const char *source, size_t *count) {
+    struct stat st;
+    char **files = NULL;
+    size_t capacity = 0;
+    int failed = 0;
+
+    *count = 0;
+
+    if (stat(source, &st) != 0) {
+        fprintf(stderr, "Error reading '%s'\n", source);
+        return NULL;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        DIR *dir = opendir(source);
+        struct dirent *entry;
+
+        if (!dir) {
+            fprintf(stderr, "Error reading directory '%s'\n", source);
+            return NULL;
+        }
+
+        while (!failed && (entry = readdir(dir))) {
+            struct stat entrySt;
+            size_t len = strlen(source) + strlen(entry->d_name) + 2;
+            char *path = malloc(len);
+
+            if (!path) {
+                failed = 1;
+                break;
+            }
+            snprintf(path, len, "%s/%s", source, entry->d_name);
+
+            if (stat(path, &entrySt) == 0 && S_ISREG(entrySt.st_mode)) {
+                failed = _bulkAddFile(&files, count, &capacity, path);
+            }
+            free(path);
+        }
+
+        closedir(dir);
+
+        if (!failed && *count > 1) {
+            qsort(files, *count, sizeof(char *), _compareFile);
+        }
+    } else {
+        FILE *list = fopen(source, "r");
+        char *line = NULL;
+        size_t lineCapacity = 0;
+        ssize_t len;
+
+        if (!list) {
+            fprintf(stderr, "Error reading file list '%s'\n", source);
+            return NULL;
+        }
+
+        while (!failed && (len = getline(&line, &lineCapacity, list)) >= 0) {
+            while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+                line[--len] = '\0';
+            }
+            if (len > 0) {
+                failed = _bulkAddFile(&files, count, &capacity, line);
+            }
+        }
+
+        free(line);
+        fclose(list);
+    }
+
+    if (failed) {
+        fprintf(stderr, "Error allocating memory\n");
+        bulkFreeList(&files, *count);
+        *count = 0;
+        return NULL;
+    }
+
+    /* An empty listing is not an error */
+    if (!files && !(files = malloc(sizeof(char *)))) {
+        fprintf(stderr, "Error allocating memory\n");
+    }
+
+    return files;
+}
+
+void bulkFreeList(char ***files, size_t count) {
+    if (*files) {
+        for (size_t i = 0; i < count; i++) {
+            free((*files)[i]);
+        }
+
+        free(*files);
+    }
+
+    *files = NULL;
+}
+
+/*
+* Counts the lines of every file the compiled FSM accepts. The calling
+* thread keeps up to BULK_QUEUE_DEPTH chunk reads in flight while workers
+* match the chunks already read. Returns non-zero if any file failed.
+*/
+int bulkCheckFiles(const FsmCompiled *compiled, char **files, size_t count, size_t workers, BulkResult *results) {
+    pthread_t threads[BULK_MAX_WORKERS];
+    size_t started = 0;
+    size_t next = 0;
+    size_t inFlight = 0;
+    int failed = 0;
+    Bulk bulk;
+
+    memset(&bulk, 0, sizeof(Bulk));
+    memset(results, 0, count * sizeof(BulkResult));
+
+    bulk.compiled = compiled;
+    bulk.filesCount = count;
+    bulk.files = calloc(count + 1, sizeof(BulkFile));
+    bulk.buffers = malloc((size_t)BULK_BUFFERS * BULK_CHUNK_SIZE);
+
+    if (!bulk.files || !bulk.buffers) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(bulk.files);
+        free(bulk.buffers);
+        return 1;
+    }
+
+    for (size_t i = 0; i < BULK_BUFFERS; i++) {
+        bulk.chunks[i].data = bulk.buffers + i * BULK_CHUNK_SIZE;
+        bulk.chunks[i].next = bulk.free;
+        bulk.free = &bulk.chunks[i];
+    }
+
+    pthread_mutex_init(&bulk.lock, NULL);
+    pthread_cond_init(&bulk.work, NULL);
+    pthread_cond_init(&bulk.progress, NULL);
+    _bulkIoInit(&bulk.io, BULK_QUEUE_DEPTH);
+
+    workers = workers < 1 ? 1 : workers > BULK_MAX_WORKERS ? BULK_MAX_WORKERS : workers;
+    for (; started < workers; started++) {
+        if (pthread_create(&threads[started], NULL, _bulkWorker, &bulk) != 0) {
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&bulk.lock);
+
+    if (started == 0) {
+        fprintf(stderr, "Error starting workers\n");
+        bulk.filesDone = count;
+        failed = 1;
+    }
+
+    while (bulk.filesDone < count) {
+        while (inFlight < BULK_QUEUE_DEPTH && bulk.free && next < count) {
+            BulkFile *file = &bulk.files[next];
+
+            if (!file->result) {
+                file->result = &results[next];
+                pthread_mutex_unlock(&bulk.lock);
+                int res = _bulkOpen(&bulk, file, files[next]);
+                pthread_mutex_lock(&bulk.lock);
+
+                /* Nothing to read, the file is done as it is */
+                if (res != 0 || file->chunksCount == 0) {
+                    results[next].error = res;
+                    if (file->fd >= 0) {
+                        close(file->fd);
+                    }
+                    bulk.filesDone++;
+                    next++;
+                    continue;
+                }
+            }
+
+            BulkChunk *chunk = bulk.free;
+            bulk.free = chunk->next;
+
+            chunk->file = file;
+            chunk->index = file->submitted++;
+            chunk->requested = file->size - chunk->index * (size_t)BULK_CHUNK_SIZE;
+            if (chunk->requested > BULK_CHUNK_SIZE) {
+                chunk->requested = BULK_CHUNK_SIZE;
+            }
+            chunk->got = 0;
+            if (file->submitted == file->chunksCount) {
+                next++;
+            }
+
+            pthread_mutex_unlock(&bulk.lock);
+            _bulkIoSubmit(&bulk.io, chunk);
+            pthread_mutex_lock(&bulk.lock);
+            inFlight++;
+        }
+
+        if (inFlight > 0) {
+            pthread_mutex_unlock(&bulk.lock);
+            BulkChunk *done = _bulkIoWait(&bulk.io);
+            pthread_mutex_lock(&bulk.lock);
+
+            while (done) {
+                BulkChunk *chunk = done;
+                done = chunk->next;
+                inFlight--;
+                _bulkReady(&bulk, chunk);
+            }
+        } else if (bulk.filesDone < count) {
+            pthread_cond_wait(&bulk.progress, &bulk.lock);
+        }
+    }
+
+    bulk.stopping = 1;
+    pthread_cond_broadcast(&bulk.work);
+    pthread_mutex_unlock(&bulk.lock);
+
+    for (size_t i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        failed |= results[i].error;
+    }
+
+    _bulkIoDestroy(&bulk.io);
+    pthread_cond_destroy(&bulk.progress);
+    pthread_cond_destroy(&bulk.work);
+    pthread_mutex_destroy(&bulk.lock);
+    free(bulk.buffers);
+    free(bulk.files);
+
+    return failed;
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+static int _bulkOpen(Bulk *bulk, BulkFile *file, const char *path) {
+    struct stat st;
+
+    file->state = fsmCompiledStart(bulk->compiled);
+
+    if ((file->fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(file->fd, &st) != 0) {
+        fprintf(stderr, "Error reading file '%s'\n", path);
+        return 1;
+    }
+
+    file->size = st.st_size;
+    file->chunksCount = (file->size + BULK_CHUNK_SIZE - 1) / BULK_CHUNK_SIZE;
+    posix_fadvise(file->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return 0;
+}
+
+/*
+* Files its chunk in order and queues the file when the chunk is the one
+* to match next. Called with the lock held.
+*/
+static void _bulkReady(Bulk *bulk, BulkChunk *chunk) {
+    BulkFile *file = chunk->file;
+    BulkChunk **position = &file->ready;
+
+    while (*position && (*position)->index < chunk->index) {
+        position = &(*position)->next;
+    }
+    chunk->next = *position;
+    *position = chunk;
+
+    if (!file->busy && !file->queued && file->ready->index == file->matched) {
+        file->queued = 1;
+        file->nextQueued = NULL;
+
+        if (bulk->queueTail) {
+            bulk->queueTail->nextQueued = file;
+        } else {
+            bulk->queueHead = file;
+        }
+        bulk->queueTail = file;
+
+        pthread_cond_signal(&bulk->work);
+    }
+}
+
+static void *_bulkWorker(void *arg) {
+    Bulk *bulk = arg;
+
+    pthread_mutex_lock(&bulk->lock);
+
+    for (;;) {
+        while (!bulk->queueHead && !bulk->stopping) {
+            pthread_cond_wait(&bulk->work, &bulk->lock);
+        }
+        if (!bulk->queueHead) {
+            break;
+        }
+
+        BulkFile *file = bulk->queueHead;
+        bulk->queueHead = file->nextQueued;
+        if (!bulk->queueHead) {
+            bulk->queueTail = NULL;
+        }
+        file->queued = 0;
+        file->busy = 1;
+
+        while (file->ready && file->ready->index == file->matched) {
+            BulkChunk *chunk = file->ready;
+            file->ready = chunk->next;
+
+            pthread_mutex_unlock(&bulk->lock);
+            _bulkMatch(bulk, file, chunk);
+            pthread_mutex_lock(&bulk->lock);
+
+            file->matched++;
+            chunk->next = bulk->free;
+            bulk->free = chunk;
+            pthread_cond_signal(&bulk->progress);
+        }
+
+        file->busy = 0;
+
+        if (file->matched == file->chunksCount) {
+            _bulkEndLine(bulk, file);
+            close(file->fd);
+            bulk->filesDone++;
+            pthread_cond_signal(&bulk->progress);
+        }
+    }
+
+    pthread_mutex_unlock(&bulk->lock);
+    return NULL;
+}
+
+static void _bulkMatch(Bulk *bulk, BulkFile *file, BulkChunk *chunk) {
+    const char *input = chunk->data;
+    const char *end = chunk->data + (chunk->len > 0 ? chunk->len : 0);
+
+    if (chunk->len < 0 || (size_t)chunk->len < chunk->requested) {
+        file->result->error = 1;
+    }
+
+    while (input < end) {
+        const char *newline = memchr(input, '\n', end - input);
+        size_t len = (newline ? newline : end) - input;
+
+        if (len > 0) {
+            file->state = fsmCompiledRun(bulk->compiled, file->state, input, len);
+            file->lineStarted = 1;
+        }
+
+        if (!newline) {
+            break;
+        }
+
+        file->lineStarted = 1;
+        _bulkEndLine(bulk, file);
+        input = newline + 1;
+    }
+}
+
+static void _bulkEndLine(Bulk *bulk, BulkFile *file) {
+    if (!file->lineStarted) {
+        return;
+    }
+
+    file->result->lines++;
+    if (fsmCompiledAccepts(bulk->compiled, file->state)) {
+        file->result->accepted++;
+    }
+
+    file->state = fsmCompiledStart(bulk->compiled);
+    file->lineStarted = 0;
+}
+
+static void _bulkIoInit(BulkIo *io, unsigned entries) {
+    struct io_uring_params params;
+
+    memset(io, 0, sizeof(BulkIo));
+    memset(&params, 0, sizeof(params));
+
+    if ((io->ring = syscall(__NR_io_uring_setup, entries, &params)) < 0) {
+        io->ring = -1;
+        return;
+    }
+
+    io->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    io->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        io->sqMapSize = io->sqMapSize > io->cqMapSize ? io->sqMapSize : io->cqMapSize;
+        io->cqMapSize = 0;
+    }
+    io->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+
+    io->sqMap = mmap(NULL, io->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_SQ_RING);
+    io->cqMap = io->cqMapSize ? mmap(NULL, io->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_CQ_RING) : io->sqMap;
+    io->sqes = mmap(NULL, io->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, io->ring, IORING_OFF_SQES);
+
+    if (io->sqMap == MAP_FAILED || io->cqMap == MAP_FAILED || io->sqes == MAP_FAILED) {
+        _bulkIoDestroy(io);
+        return;
+    }
+
+    io->sqTail = (unsigned *)((char *)io->sqMap + params.sq_off.tail);
+    io->sqMask = (unsigned *)((char *)io->sqMap + params.sq_off.ring_mask);
+    io->sqArray = (unsigned *)((char *)io->sqMap + params.sq_off.array);
+    io->cqHead = (unsigned *)((char *)io->cqMap + params.cq_off.head);
+    io->cqTail = (unsigned *)((char *)io->cqMap + params.cq_off.tail);
+    io->cqMask = (unsigned *)((char *)io->cqMap + params.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *)((char *)io->cqMap + params.cq_off.cqes);
+}
+
+/*
+* Falls back to pread from then on.
+*/
+static void _bulkIoDestroy(BulkIo *io) {
+    if (io->sqes && io->sqes != MAP_FAILED) {
+        munmap(io->sqes, io->sqesSize);
+    }
+    if (io->cqMapSize && io->cqMap && io->cqMap != MAP_FAILED) {
+        munmap(io->cqMap, io->cqMapSize);
+    }
+    if (io->sqMap && io->sqMap != MAP_FAILED) {
+        munmap(io->sqMap, io->sqMapSize);
+    }
+    if (io->ring >= 0) {
+        close(io->ring);
+    }
+
+    memset(io, 0, sizeof(BulkIo));
+    io->ring = -1;
+}
+
+/*
+* Queues the read of what is left of a chunk, submitted with the next
+* _bulkIoWait. The fallback reads it right away.
+*/
+static void _bulkIoSubmit(BulkIo *io, BulkChunk *chunk) {
+    off_t offset = chunk->index * (off_t)BULK_CHUNK_SIZE + chunk->got;
+
+    if (io->ring < 0) {
+        _bulkIoRead(io, chunk);
+        return;
+    }
+
+    unsigned tail = *io->sqTail;
+    unsigned index = tail & *io->sqMask;
+    struct io_uring_sqe *sqe = &io->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = chunk->file->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(chunk->data + chunk->got);
+    sqe->len = chunk->requested - chunk->got;
+    sqe->off = offset;
+    sqe->user_data = (uint64_t)(uintptr_t)chunk;
+
+    io->sqArray[index] = index;
+    __atomic_store_n(io->sqTail, tail + 1, __ATOMIC_RELEASE);
+    io->pending++;
+}
+
+/*
+* Submits the queued reads and waits for at least one to complete.
+* Returns the completed chunks, none when every completion was short and
+* its rest queued again.
+*/
+static BulkChunk *_bulkIoWait(BulkIo *io) {
+    BulkChunk *done = NULL;
+
+    if (io->ring < 0) {
+        done = io->done;
+        io->done = NULL;
+        return done;
+    }
+
+    for (;;) {
+        int res = syscall(__NR_io_uring_enter, io->ring, io->pending, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+
+        if (res >= 0) {
+            io->pending -= (unsigned)res < io->pending ? (unsigned)res : io->pending;
+            break;
+        } else if (errno != EINTR) {
+            /* Read what the ring did not take with pread instead */
+            unsigned tail = *io->sqTail;
+            for (unsigned i = tail - io->pending; i != tail; i++) {
+                _bulkIoRead(io, (BulkChunk *)(uintptr_t)io->sqes[io->sqArray[i & *io->sqMask]].user_data);
+            }
+            io->pending = 0;
+            break;
+        }
+    }
+
+    unsigned head = *io->cqHead;
+    while (head != __atomic_load_n(io->cqTail, __ATOMIC_ACQUIRE)) {
+        struct io_uring_cqe *cqe = &io->cqes[head & *io->cqMask];
+        BulkChunk *chunk = (BulkChunk *)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+
+        head++;
+
+        if (res < 0) {
+            /* Some files do not support it, pread tells real errors */
+            _bulkIoRead(io, chunk);
+        } else if (res > 0 && chunk->got + res < chunk->requested) {
+            chunk->got += res;
+            _bulkIoSubmit(io, chunk);
+        } else {
+            chunk->len = chunk->got + res;
+            chunk->next = io->done;
+            io->done = chunk;
+        }
+    }
+    __atomic_store_n(io->cqHead, head, __ATOMIC_RELEASE);
+
+    done = io->done;
+    io->done = NULL;
+    return done;
+}
+
+/*
+* Reads the rest of the chunk with pread, the fallback for io_uring.
+*/
+static void _bulkIoRead(BulkIo *io, BulkChunk *chunk) {
+    off_t offset = chunk->index * (off_t)BULK_CHUNK_SIZE;
+    size_t got = chunk->got;
+    ssize_t len = 0;
+
+    while (got < chunk->requested && (len = pread(chunk->file->fd, chunk->data + got, chunk->requested - got, offset + got)) != 0) {
+        if (len < 0 && errno != EINTR) {
+            break;
+        } else if (len > 0) {
+            got += len;
+        }
+    }
+
+    chunk->len = len < 0 ? -errno : (ssize_t)got;
+    chunk->next = io->done;
+    io->done = chunk;
+}
+
+static int _bulkAddFile(char ***files, size_t *count, size_t *capacity, const char *path) {
+    if (*count >= *capacity) {
+        size_t grownCapacity = *capacity ? *capacity * 2 : 64;
+        char **grown = realloc(*files, grownCapacity * sizeof(char *));
+
+        if (!grown) {
+            return 1;
+        }
+
+        *files = grown;
+        *capacity = grownCapacity;
+    }
+
+    if (!((*files)[*count] = strdup(path))) {
+        return 1;
+    }
+
+    (*count)++;
+    return 0;
+}
+
+static int _compareFile(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
@@ -0,0 +1,30 @@
+#ifndef _BULK_H_
+#define _BULK_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+#include "../fsm/fsm.h"
+
+/*
+* Outcome of checking every line of one file. error is set when the file
+* could not be opened or read, the counts then cover what was read.
+*/
+typedef struct SBulkResult {
+    size_t lines;
+    size_t accepted;
+    int error;
+} BulkResult;
+
+char **bulkListFiles(const char *source, size_t *count);
+void bulkFreeList(char ***files, size_t count);
+int bulkCheckFiles(const FsmCompiled *compiled, char **files, size_t count, size_t workers, BulkResult *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _BULK_H_
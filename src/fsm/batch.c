@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fsm.h"
+
+typedef struct SBatchInput {
+    const char *input;
+    size_t len;
+    size_t index;
+} BatchInput;
+
+/*
+* State reached after the first depth bytes of the current input, kept
+* for the inputs after it that share those bytes.
+*/
+typedef struct SBatchCheckpoint {
+    size_t depth;
+    FsmState state;
+} BatchCheckpoint;
+
+static int _batchCompare(const void *a, const void *b);
+static size_t _batchCommonPrefix(const BatchInput *a, const BatchInput *b);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+/*
+* Checks many inputs at once, walking every prefix they share only once.
+* The inputs are sorted, so that the ones sharing a prefix follow each
+* other, and each input resumes from the state checkpointed where it
+* leaves the previous one. Checkpoints are only taken at the depths later
+* inputs resume from, the branches of the trie of the inputs. results[i]
+* is set for inputs[i]; walked, when given, receives the number of bytes
+* run through the FSM.
+*/
+int fsmCompiledCheckBatch(const FsmCompiled *compiled, const char *const *inputs, const size_t *lens, size_t count, int *results, size_t *walked) {
+    BatchInput *sorted = malloc((count + 1) * sizeof(BatchInput));
+    size_t *lcp = malloc((count + 1) * sizeof(size_t));
+    size_t *nextSmaller = malloc((count + 1) * sizeof(size_t));
+    size_t *pending = malloc((count + 1) * sizeof(size_t));
+    BatchCheckpoint *checkpoints = malloc((count + 2) * sizeof(BatchCheckpoint));
+    size_t checkpointsCount = 0;
+    size_t bytes = 0;
+
+    if (!sorted || !lcp || !nextSmaller || !pending || !checkpoints) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(sorted);
+        free(lcp);
+        free(nextSmaller);
+        free(pending);
+        free(checkpoints);
+        return 1;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        sorted[i].input = inputs[i];
+        sorted[i].len = lens[i];
+        sorted[i].index = i;
+    }
+    qsort(sorted, count, sizeof(BatchInput), _batchCompare);
+
+    /* lcp[i] is shared with the input before, 0 past both ends */
+    lcp[0] = 0;
+    lcp[count] = 0;
+    for (size_t i = 1; i < count; i++) {
+        lcp[i] = _batchCommonPrefix(&sorted[i - 1], &sorted[i]);
+    }
+
+    /* Next input sharing strictly less, jumping along the ones found */
+    for (size_t i = count; i-- > 1;) {
+        size_t j = i + 1;
+
+        while (j < count && lcp[j] >= lcp[i]) {
+            j = nextSmaller[j];
+        }
+        nextSmaller[i] = j;
+    }
+
+    checkpoints[checkpointsCount].depth = 0;
+    checkpoints[checkpointsCount++].state = fsmCompiledStart(compiled);
+
+    for (size_t i = 0; i < count; i++) {
+        const BatchInput *current = &sorted[i];
+        size_t resume = lcp[i];
+        size_t pendingCount = 0;
+
+        /* The checkpoint at resume was taken by an earlier input */
+        while (checkpoints[checkpointsCount - 1].depth > resume) {
+            checkpointsCount--;
+        }
+
+        FsmState state = checkpoints[checkpointsCount - 1].state;
+        size_t depth = resume;
+
+        /* Depths later inputs resume from, deepest first */
+        for (size_t j = i + 1; j < count && lcp[j] > resume; j = nextSmaller[j]) {
+            pending[pendingCount++] = lcp[j];
+        }
+
+        while (pendingCount > 0) {
+            size_t next = pending[--pendingCount];
+
+            state = fsmCompiledRun(compiled, state, current->input + depth, next - depth);
+            bytes += next - depth;
+            depth = next;
+
+            checkpoints[checkpointsCount].depth = depth;
+            checkpoints[checkpointsCount++].state = state;
+        }
+
+        state = fsmCompiledRun(compiled, state, current->input + depth, current->len - depth);
+        bytes += current->len - depth;
+
+        results[current->index] = fsmCompiledAccepts(compiled, state);
+    }
+
+    if (walked) {
+        *walked = bytes;
+    }
+
+    free(sorted);
+    free(lcp);
+    free(nextSmaller);
+    free(pending);
+    free(checkpoints);
+    return 0;
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+static int _batchCompare(const void *a, const void *b) {
+    const BatchInput *left = a;
+    const BatchInput *right = b;
+    size_t len = left->len < right->len ? left->len : right->len;
+    int res = memcmp(left->input, right->input, len);
+
+    if (res != 0) {
+        return res;
+    }
+
+    return left->len < right->len ? -1 : left->len > right->len;
+}
+
+static size_t _batchCommonPrefix(const BatchInput *a, const BatchInput *b) {
+    size_t len = a->len < b->len ? a->len : b->len;
+    size_t i = 0;
+
+    while (i < len && a->input[i] == b->input[i]) {
+        i++;
+    }
+
+    return i;
+}
@@ -0,0 +1,362 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fsm.h"
+#include "table.h"
+
+#define CACHE_MAX_SHARDS 16
+#define CACHE_LINE 64
+#define CACHE_NONE UINT32_MAX
+
+/*
+* One remembered input. Entries are chained by bucket and linked from the
+* most to the least recently used.
+*/
+typedef struct SCacheEntry {
+    uint64_t hash;
+    uint64_t id;
+    char *input;
+    size_t len;
+    int accepted;
+    uint32_t next;
+    uint32_t newer;
+    uint32_t older;
+} CacheEntry;
+
+/*
+* An LRU of its own with its own lock, so threads checking different
+* inputs rarely wait for each other. Shards sit on their own cache lines.
+*/
+typedef struct SCacheShard {
+    pthread_mutex_t lock;
+    CacheEntry *entries;
+    size_t entriesCount;
+    size_t capacity;
+    uint32_t *buckets;
+    size_t bucketsCount;
+    uint32_t newest;
+    uint32_t oldest;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+} __attribute__((aligned(CACHE_LINE))) CacheShard;
+
+struct SFsmCache {
+    CacheShard *shards;
+    size_t shardsCount;
+    size_t bypassed;
+};
+
+static uint64_t _fsmCacheHash(const FsmCompiled *compiled, const char *input, size_t len);
+static CacheShard *_fsmCacheShard(FsmCache *cache, uint64_t hash);
+static uint32_t _fsmCacheFind(CacheShard *shard, uint64_t hash, uint64_t id, const char *input, size_t len);
+static void _fsmCacheUnlink(CacheShard *shard, uint32_t index);
+static void _fsmCachePushNewest(CacheShard *shard, uint32_t index);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+/*
+* Remembers the result of up to capacity inputs, of any compiled FSMs,
+* evicting the least recently used ones. Can be used from several
+* threads.
+*/
+FsmCache *fsmCacheCreate(size_t capacity) {
+    size_t len = sizeof(FsmCache);
+
+    if (capacity == 0) {
+        fprintf(stderr, "Error cache capacity must be positive\n");
+        return NULL;
+    }
+
+    FsmCache *cache = malloc(len);
+    if (!cache) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    memset(cache, 0, len);
+
+    /* A power of two, with at least one entry each */
+    cache->shardsCount = 1;
+    while (cache->shardsCount < CACHE_MAX_SHARDS && cache->shardsCount * 2 <= capacity) {
+        cache->shardsCount *= 2;
+    }
+
+    if (posix_memalign((void **)&cache->shards, CACHE_LINE, cache->shardsCount * sizeof(CacheShard)) != 0) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(cache);
+        return NULL;
+    }
+    memset(cache->shards, 0, cache->shardsCount * sizeof(CacheShard));
+
+    for (size_t i = 0; i < cache->shardsCount; i++) {
+        CacheShard *shard = &cache->shards[i];
+
+        shard->capacity = capacity / cache->shardsCount + (i < capacity % cache->shardsCount);
+        shard->bucketsCount = 1;
+        while (shard->bucketsCount < shard->capacity) {
+            shard->bucketsCount *= 2;
+        }
+        shard->newest = CACHE_NONE;
+        shard->oldest = CACHE_NONE;
+        shard->entries = malloc(shard->capacity * sizeof(CacheEntry));
+        shard->buckets = malloc(shard->bucketsCount * sizeof(uint32_t));
+
+        if (!shard->entries || !shard->buckets || pthread_mutex_init(&shard->lock, NULL) != 0) {
+            fprintf(stderr, "Error allocating memory\n");
+            free(shard->entries);
+            free(shard->buckets);
+            cache->shardsCount = i;
+            fsmCacheDestroy(&cache);
+            return NULL;
+        }
+
+        for (size_t j = 0; j < shard->bucketsCount; j++) {
+            shard->buckets[j] = CACHE_NONE;
+        }
+    }
+
+    return cache;
+}
+
+void fsmCacheDestroy(FsmCache **cache) {
+    if (*cache) {
+        for (size_t i = 0; i < (*cache)->shardsCount; i++) {
+            CacheShard *shard = &(*cache)->shards[i];
+
+            for (size_t j = 0; j < shard->entriesCount; j++) {
+                free(shard->entries[j].input);
+            }
+
+            pthread_mutex_destroy(&shard->lock);
+            free(shard->entries);
+            free(shard->buckets);
+        }
+
+        free((*cache)->shards);
+        free(*cache);
+    }
+
+    *cache = NULL;
+}
+
+/*
+* Same as fsmCompiledCheck, answered from the cache when the same input
+* was checked against the same compiled FSM before. Inputs longer than
+* FSM_CACHE_MAX_INPUT are always walked.
+*/
+int fsmCacheCheck(FsmCache *cache, const FsmCompiled *compiled, const char *input, size_t len) {
+    int accepted = fsmCacheLookup(cache, compiled, input, len);
+
+    if (accepted < 0) {
+        accepted = fsmCompiledCheck(compiled, input, len);
+        fsmCacheInsert(cache, compiled, input, len, accepted);
+    }
+
+    return accepted;
+}
+
+/*
+* Returns the remembered result, or -1 when the input has to be checked.
+*/
+int fsmCacheLookup(FsmCache *cache, const FsmCompiled *compiled, const char *input, size_t len) {
+    if (len > FSM_CACHE_MAX_INPUT) {
+        __atomic_add_fetch(&cache->bypassed, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    uint64_t hash = _fsmCacheHash(compiled, input, len);
+    CacheShard *shard = _fsmCacheShard(cache, hash);
+    int accepted = -1;
+
+    pthread_mutex_lock(&shard->lock);
+
+    uint32_t index = _fsmCacheFind(shard, hash, fsmCompiledGetId(compiled), input, len);
+    if (index != CACHE_NONE) {
+        accepted = shard->entries[index].accepted;
+        shard->hits++;
+
+        if (shard->newest != index) {
+            _fsmCacheUnlink(shard, index);
+            _fsmCachePushNewest(shard, index);
+        }
+    } else {
+        shard->misses++;
+    }
+
+    pthread_mutex_unlock(&shard->lock);
+    return accepted;
+}
+
+/*
+* Remembers the result of an input, in place of the least recently used
+* one once its shard is full. Returns non-zero if it could not be kept.
+*/
+int fsmCacheInsert(FsmCache *cache, const FsmCompiled *compiled, const char *input, size_t len, int accepted) {
+    if (len > FSM_CACHE_MAX_INPUT) {
+        return 1;
+    }
+
+    uint64_t hash = _fsmCacheHash(compiled, input, len);
+    uint64_t id = fsmCompiledGetId(compiled);
+    CacheShard *shard = _fsmCacheShard(cache, hash);
+    char *copy = malloc(len + 1);
+    char *evicted = NULL;
+
+    if (!copy) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+    memcpy(copy, input, len);
+
+    pthread_mutex_lock(&shard->lock);
+
+    /* Another thread may have added it since the lookup */
+    if (_fsmCacheFind(shard, hash, id, input, len) != CACHE_NONE) {
+        pthread_mutex_unlock(&shard->lock);
+        free(copy);
+        return 0;
+    }
+
+    uint32_t index;
+
+    if (shard->entriesCount < shard->capacity) {
+        index = shard->entriesCount++;
+    } else {
+        index = shard->oldest;
+        _fsmCacheUnlink(shard, index);
+
+        uint32_t *link = &shard->buckets[shard->entries[index].hash & (shard->bucketsCount - 1)];
+        while (*link != index) {
+            link = &shard->entries[*link].next;
+        }
+        *link = shard->entries[index].next;
+        evicted = shard->entries[index].input;
+        shard->evictions++;
+    }
+
+    CacheEntry *entry = &shard->entries[index];
+    size_t bucket = hash & (shard->bucketsCount - 1);
+
+    entry->hash = hash;
+    entry->id = id;
+    entry->input = copy;
+    entry->len = len;
+    entry->accepted = accepted;
+    entry->next = shard->buckets[bucket];
+    shard->buckets[bucket] = index;
+    _fsmCachePushNewest(shard, index);
+
+    pthread_mutex_unlock(&shard->lock);
+
+    free(evicted);
+    return 0;
+}
+
+void fsmCacheGetStats(FsmCache *cache, FsmCacheStats *stats) {
+    memset(stats, 0, sizeof(FsmCacheStats));
+
+    for (size_t i = 0; i < cache->shardsCount; i++) {
+        CacheShard *shard = &cache->shards[i];
+
+        pthread_mutex_lock(&shard->lock);
+        stats->hits += shard->hits;
+        stats->misses += shard->misses;
+        stats->evictions += shard->evictions;
+        stats->entries += shard->entriesCount;
+        stats->capacity += shard->capacity;
+        pthread_mutex_unlock(&shard->lock);
+    }
+
+    stats->bypassed = __atomic_load_n(&cache->bypassed, __ATOMIC_RELAXED);
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+/*
+* Eight bytes at a time, seeded with the compiled FSM so that the same
+* input checked against two FSMs lands in different buckets.
+*/
+static uint64_t _fsmCacheHash(const FsmCompiled *compiled, const char *input, size_t len) {
+    const uint64_t multiplier = 0x9e3779b97f4a7c15ULL;
+    uint64_t hash = (fsmCompiledGetId(compiled) + len) * multiplier;
+    size_t i = 0;
+
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+
+        memcpy(&word, input + i, sizeof(word));
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
+    }
+
+    if (i < len) {
+        uint64_t word = 0;
+
+        memcpy(&word, input + i, len - i);
+        hash = (hash ^ word) * multiplier;
+        hash ^= hash >> 29;
+    }
+
+    hash ^= hash >> 32;
+    return hash * multiplier;
+}
+
+/*
+* Shards are picked by the top bits, buckets by the bottom ones.
+*/
+static CacheShard *_fsmCacheShard(FsmCache *cache, uint64_t hash) {
+    return &cache->shards[(hash >> 56) & (cache->shardsCount - 1)];
+}
+
+/*
+* Called with the shard's lock held.
+*/
+static uint32_t _fsmCacheFind(CacheShard *shard, uint64_t hash, uint64_t id, const char *input, size_t len) {
+    uint32_t index = shard->buckets[hash & (shard->bucketsCount - 1)];
+
+    for (; index != CACHE_NONE; index = shard->entries[index].next) {
+        const CacheEntry *entry = &shard->entries[index];
+
+        if (entry->hash == hash && entry->id == id && entry->len == len && memcmp(entry->input, input, len) == 0) {
+            return index;
+        }
+    }
+
+    return CACHE_NONE;
+}
+
+static void _fsmCacheUnlink(CacheShard *shard, uint32_t index) {
+    CacheEntry *entry = &shard->entries[index];
+
+    if (entry->newer != CACHE_NONE) {
+        shard->entries[entry->newer].older = entry->older;
+    } else {
+        shard->newest = entry->older;
+    }
+
+    if (entry->older != CACHE_NONE) {
+        shard->entries[entry->older].newer = entry->newer;
+    } else {
+        shard->oldest = entry->newer;
+    }
+}
+
+static void _fsmCachePushNewest(CacheShard *shard, uint32_t index) {
+    CacheEntry *entry = &shard->entries[index];
+
+    entry->newer = CACHE_NONE;
+    entry->older = shard->newest;
+
+    if (shard->newest != CACHE_NONE) {
+        shard->entries[shard->newest].newer = index;
+    } else {
+        shard->oldest = index;
+    }
+    shard->newest = index;
+}
@@ -0,0 +1,400 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "table.h"
+
+#define CANONICAL_HASH_BASIS 14695981039346656037ull
+#define CANONICAL_HASH_PRIME 1099511628211ull
+
+static uint32_t *_tableCanonicalEdges(const TableSource *source);
+static unsigned char *_tableCanonicalKeep(const TableSource *source, const uint32_t *edges);
+static size_t _tableCanonicalRefine(const uint32_t *edges, size_t alphabetCount, const uint32_t *kept, size_t keptCount, uint32_t *blockOf);
+static uint64_t _tableCanonicalMix(uint64_t hash, uint64_t value);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+/*
+* Trims the source to the states reachable from the start that can still
+* reach an accepting state, merges the equivalent ones by partition
+* refinement and numbers what is left breadth-first, following symbols
+* in byte order. Release with tableCanonicalDestroy, also on error.
+*/
+int tableCanonicalize(const TableSource *source, TableCanonical *canonical) {
+    size_t statesCount = source->statesCount;
+    size_t alphabetCount = source->alphabetCount;
+    uint32_t *edges = NULL, *kept = NULL, *blockOf = NULL, *numberOf = NULL, *first = NULL;
+    unsigned char *keep = NULL;
+    size_t keptCount = 0, blocksCount, numbered = 0;
+    int res = 1;
+
+    memset(canonical, 0, sizeof(TableCanonical));
+    canonical->source.alphabet = canonical->alphabet;
+    canonical->source.startState = -1;
+
+    canonical->stateOf = malloc((statesCount + 1) * sizeof(uint32_t));
+    canonical->acceptStates = calloc(statesCount + 1, 1);
+    canonical->transitions = malloc((statesCount * alphabetCount + 1) * sizeof(Transition));
+    edges = _tableCanonicalEdges(source);
+    kept = malloc((statesCount + 1) * sizeof(uint32_t));
+    blockOf = malloc((statesCount + 1) * sizeof(uint32_t));
+    numberOf = malloc((statesCount + 1) * sizeof(uint32_t));
+    first = malloc((statesCount + 1) * sizeof(uint32_t));
+
+    if (!canonical->stateOf || !canonical->acceptStates || !canonical->transitions || !edges || !kept || !blockOf || !numberOf || !first) {
+        goto done;
+    }
+
+    canonical->source.acceptStates = canonical->acceptStates;
+    canonical->source.transitions = canonical->transitions;
+
+    for (size_t i = 0; i < statesCount; i++) {
+        canonical->stateOf[i] = TABLE_REJECT;
+    }
+
+    if (!(keep = _tableCanonicalKeep(source, edges))) {
+        goto done;
+    }
+
+    /* Nothing accepted: the empty machine, with no states at all */
+    if (source->startState < 0 || !keep[source->startState]) {
+        res = 0;
+        goto done;
+    }
+
+    /* Edges into dropped states reject just like missing ones */
+    for (size_t i = 0; i < statesCount; i++) {
+        if (!keep[i]) {
+            continue;
+        }
+        kept[keptCount++] = i;
+        for (size_t j = 0; j < alphabetCount; j++) {
+            uint32_t *edge = &edges[i * alphabetCount + j];
+
+            if (*edge != TABLE_REJECT && !keep[*edge]) {
+                *edge = TABLE_REJECT;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < keptCount; i++) {
+        blockOf[kept[i]] = source->acceptStates[kept[i]] ? 1 : 0;
+    }
+    if ((blocksCount = _tableCanonicalRefine(edges, alphabetCount, kept, keptCount, blockOf)) == 0) {
+        goto done;
+    }
+
+    /* Symbols in byte order, without the ones no kept edge uses */
+    size_t used[256];
+    size_t usedCount = 0;
+    for (size_t c = 0; c < 256; c++) {
+        for (size_t j = 0; j < alphabetCount; j++) {
+            if ((unsigned char)source->alphabet[j] != c) {
+                continue;
+            }
+            for (size_t i = 0; i < keptCount; i++) {
+                if (edges[kept[i] * alphabetCount + j] != TABLE_REJECT) {
+                    canonical->alphabet[usedCount] = c;
+                    used[usedCount++] = j;
+                    break;
+                }
+            }
+            break;
+        }
+    }
+    canonical->source.alphabetCount = usedCount;
+
+    /* first[block] is a state of the block, the walk goes block by block */
+    for (size_t i = 0; i < blocksCount; i++) {
+        numberOf[i] = TABLE_REJECT;
+    }
+    numberOf[blockOf[source->startState]] = numbered++;
+    first[0] = source->startState;
+
+    for (size_t number = 0; number < numbered; number++) {
+        uint32_t state = first[number];
+
+        canonical->acceptStates[number] = source->acceptStates[state] ? 1 : 0;
+
+        for (size_t k = 0; k < usedCount; k++) {
+            uint32_t next = edges[state * alphabetCount + used[k]];
+            Transition *t;
+
+            if (next == TABLE_REJECT) {
+                continue;
+            }
+            if (numberOf[blockOf[next]] == TABLE_REJECT) {
+                first[numbered] = next;
+                numberOf[blockOf[next]] = numbered++;
+            }
+
+            t = &canonical->transitions[canonical->source.transitionsCount++];
+            t->from = number;
+            t->c = canonical->alphabet[k];
+            t->to = numberOf[blockOf[next]];
+        }
+    }
+
+    for (size_t i = 0; i < keptCount; i++) {
+        canonical->stateOf[kept[i]] = numberOf[blockOf[kept[i]]];
+    }
+
+    canonical->source.statesCount = numbered;
+    canonical->source.startState = 0;
+    res = 0;
+
+done:
+    if (res == 0) {
+        uint64_t hash = CANONICAL_HASH_BASIS;
+
+        hash = _tableCanonicalMix(hash, canonical->source.statesCount);
+        hash = _tableCanonicalMix(hash, canonical->source.alphabetCount);
+        for (size_t i = 0; i < canonical->source.alphabetCount; i++) {
+            hash = _tableCanonicalMix(hash, (unsigned char)canonical->alphabet[i]);
+        }
+        for (size_t i = 0; i < canonical->source.statesCount; i++) {
+            hash = _tableCanonicalMix(hash, canonical->acceptStates[i]);
+        }
+        for (size_t i = 0; i < canonical->source.transitionsCount; i++) {
+            Transition t = canonical->transitions[i];
+
+            hash = _tableCanonicalMix(hash, t.from);
+            hash = _tableCanonicalMix(hash, (unsigned char)t.c);
+            hash = _tableCanonicalMix(hash, t.to);
+        }
+        canonical->hash = hash;
+    }
+
+    free(edges);
+    free(keep);
+    free(kept);
+    free(blockOf);
+    free(numberOf);
+    free(first);
+    return res;
+}
+
+void tableCanonicalDestroy(TableCanonical *canonical) {
+    free(canonical->transitions);
+    free(canonical->acceptStates);
+    free(canonical->stateOf);
+    memset(canonical, 0, sizeof(TableCanonical));
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+/*
+* Target of every state and symbol, in the source alphabet order. The
+* first transition of a pair wins, as in the compiled table.
+*/
+static uint32_t *_tableCanonicalEdges(const TableSource *source) {
+    size_t alphabetCount = source->alphabetCount;
+    size_t cellsCount = source->statesCount * alphabetCount;
+    uint32_t *edges = malloc((cellsCount + 1) * sizeof(uint32_t));
+    short classOf[256];
+
+    if (!edges) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < 256; i++) {
+        classOf[i] = -1;
+    }
+    for (size_t i = 0; i < alphabetCount; i++) {
+        classOf[(unsigned char)source->alphabet[i]] = i;
+    }
+    for (size_t i = 0; i < cellsCount; i++) {
+        edges[i] = TABLE_REJECT;
+    }
+    for (size_t i = 0; i < source->transitionsCount; i++) {
+        Transition t = source->transitions[i];
+        uint32_t *edge = &edges[t.from * alphabetCount + classOf[(unsigned char)t.c]];
+
+        if (*edge == TABLE_REJECT) {
+            *edge = t.to;
+        }
+    }
+
+    return edges;
+}
+
+/*
+* Marks the states reachable from the start, then keeps those from which
+* an accepting state can be reached, walking the edges backwards.
+*/
+static unsigned char *_tableCanonicalKeep(const TableSource *source, const uint32_t *edges) {
+    size_t statesCount = source->statesCount;
+    size_t alphabetCount = source->alphabetCount;
+    size_t cellsCount = statesCount * alphabetCount;
+    unsigned char *reached = calloc(statesCount + 1, 1);
+    unsigned char *keep = calloc(statesCount + 1, 1);
+    uint32_t *queue = malloc((statesCount + 1) * sizeof(uint32_t));
+    uint32_t *incomingStart = calloc(statesCount + 2, sizeof(uint32_t));
+    uint32_t *incoming = malloc((cellsCount + 1) * sizeof(uint32_t));
+    size_t head = 0, tail = 0;
+
+    if (!reached || !keep || !queue || !incomingStart || !incoming) {
+        free(keep);
+        keep = NULL;
+        goto done;
+    }
+
+    if (source->startState >= 0) {
+        queue[tail++] = source->startState;
+        reached[source->startState] = 1;
+    }
+    while (head < tail) {
+        uint32_t state = queue[head++];
+
+        for (size_t j = 0; j < alphabetCount; j++) {
+            uint32_t next = edges[state * alphabetCount + j];
+
+            if (next != TABLE_REJECT && !reached[next]) {
+                reached[next] = 1;
+                queue[tail++] = next;
+            }
+        }
+    }
+
+    /* Predecessors of every state, grouped by target */
+    for (size_t i = 0; i < cellsCount; i++) {
+        if (edges[i] != TABLE_REJECT) {
+            incomingStart[edges[i] + 1]++;
+        }
+    }
+    for (size_t i = 0; i < statesCount; i++) {
+        incomingStart[i + 1] += incomingStart[i];
+    }
+    for (size_t i = 0; i < cellsCount; i++) {
+        if (edges[i] != TABLE_REJECT) {
+            incoming[incomingStart[edges[i]]++] = i / alphabetCount;
+        }
+    }
+    for (size_t i = statesCount; i > 0; i--) {
+        incomingStart[i] = incomingStart[i - 1];
+    }
+    incomingStart[0] = 0;
+
+    head = tail = 0;
+    for (size_t i = 0; i < statesCount; i++) {
+        if (reached[i] && source->acceptStates[i]) {
+            keep[i] = 1;
+            queue[tail++] = i;
+        }
+    }
+    while (head < tail) {
+        uint32_t state = queue[head++];
+
+        for (uint32_t k = incomingStart[state]; k < incomingStart[state + 1]; k++) {
+            uint32_t previous = incoming[k];
+
+            if (reached[previous] && !keep[previous]) {
+                keep[previous] = 1;
+                queue[tail++] = previous;
+            }
+        }
+    }
+
+done:
+    free(reached);
+    free(queue);
+    free(incomingStart);
+    free(incoming);
+    return keep;
+}
+
+/*
+* Splits the blocks of blockOf until every state of a block goes to the
+* same blocks on every symbol. Each round gives every state the number
+* of the first state seen with the same block and successor blocks,
+* found through an open addressing table. Returns the number of blocks,
+* 0 when memory runs out.
+*/
+static size_t _tableCanonicalRefine(const uint32_t *edges, size_t alphabetCount, const uint32_t *kept, size_t keptCount, uint32_t *blockOf) {
+    size_t slotsCount = 16;
+    size_t blocksCount = 0;
+    uint32_t *slots, *nextBlockOf, *blockState;
+
+    while (slotsCount < keptCount * 2) {
+        slotsCount *= 2;
+    }
+
+    slots = malloc(slotsCount * sizeof(uint32_t));
+    nextBlockOf = malloc((keptCount + 1) * sizeof(uint32_t));
+    blockState = malloc((keptCount + 1) * sizeof(uint32_t));
+
+    if (!slots || !nextBlockOf || !blockState) {
+        free(slots);
+        free(nextBlockOf);
+        free(blockState);
+        return 0;
+    }
+
+    for (;;) {
+        size_t mask = slotsCount - 1;
+        size_t count = 0;
+
+        for (size_t i = 0; i < slotsCount; i++) {
+            slots[i] = TABLE_REJECT;
+        }
+
+        for (size_t i = 0; i < keptCount; i++) {
+            const uint32_t *row = &edges[kept[i] * alphabetCount];
+            uint64_t hash = _tableCanonicalMix(CANONICAL_HASH_BASIS, blockOf[kept[i]]);
+            size_t slot;
+
+            for (size_t j = 0; j < alphabetCount; j++) {
+                hash = _tableCanonicalMix(hash, row[j] == TABLE_REJECT ? TABLE_REJECT : blockOf[row[j]]);
+            }
+
+            for (slot = hash & mask; slots[slot] != TABLE_REJECT; slot = (slot + 1) & mask) {
+                const uint32_t *other = &edges[kept[slots[slot]] * alphabetCount];
+                size_t j = 0;
+
+                if (blockOf[kept[slots[slot]]] != blockOf[kept[i]]) {
+                    continue;
+                }
+                while (j < alphabetCount && (row[j] == TABLE_REJECT ? other[j] == TABLE_REJECT : other[j] != TABLE_REJECT && blockOf[row[j]] == blockOf[other[j]])) {
+                    j++;
+                }
+                if (j == alphabetCount) {
+                    break;
+                }
+            }
+
+            if (slots[slot] == TABLE_REJECT) {
+                slots[slot] = i;
+                blockState[i] = count++;
+            }
+            nextBlockOf[i] = blockState[slots[slot]];
+        }
+
+        /* Blocks only ever split, so the same count means nothing moved */
+        int stable = count == blocksCount;
+        for (size_t i = 0; i < keptCount; i++) {
+            blockOf[kept[i]] = nextBlockOf[i];
+        }
+        blocksCount = count;
+
+        if (stable) {
+            break;
+        }
+    }
+
+    free(slots);
+    free(nextBlockOf);
+    free(blockState);
+    return blocksCount;
+}
+
+static uint64_t _tableCanonicalMix(uint64_t hash, uint64_t value) {
+    for (size_t i = 0; i < sizeof(uint32_t); i++) {
+        hash = (hash ^ ((value >> (i * 8)) & 0xff)) * CANONICAL_HASH_PRIME;
+    }
+
+    return hash;
+}
@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "table.h"
+
+/*
+* Snapshot of a builder: its own copy of the names and its own table,
+* nothing is written after fsmCompiledCreate returns but the reference
+* count. A table from a pool belongs to the pool entry instead, and
+* visitOf gives the state whose visits each of its rows counts as. id is
+* never reused, unlike the address.
+*/
+struct SFsmCompiled {
+    size_t refs;
+    uint64_t id;
+    char *name;
+    char **states;
+    size_t statesCount;
+    Table *table;
+    FsmPool *pool;
+    FsmPoolEntry *entry;
+    uint32_t *visitOf;
+};
+
+static FsmCompiled *_fsmCompiledCreateNames(Fsm *fsm);
+static void _fsmCompiledDestroy(FsmCompiled *compiled);
+
+static uint64_t _fsmCompiledLastId = 0;
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+/*
+* Compiles the builder as it is now, with its layout and state order. The
+* result does not reference the builder, which can be changed or
+* destroyed right after.
+*/
+FsmCompiled *fsmCompiledCreate(Fsm *fsm) {
+    FsmCompiled *compiled = _fsmCompiledCreateNames(fsm);
+
+    if (!compiled) {
+        return NULL;
+    }
+
+    if (!(compiled->table = fsmCompileTable(fsm))) {
+        _fsmCompiledDestroy(compiled);
+        return NULL;
+    }
+
+    return compiled;
+}
+
+/*
+* Wraps a pool's table for the builder, taking over the reference the
+* caller holds on the entry. stateOf maps the builder states to the
+* table rows, several of them can share a row.
+*/
+FsmCompiled *fsmCompiledCreateShared(Fsm *fsm, FsmPool *pool, FsmPoolEntry *entry, Table *table, const uint32_t *stateOf) {
+    FsmCompiled *compiled = _fsmCompiledCreateNames(fsm);
+    FsmTableInfo info;
+
+    if (!compiled) {
+        fsmPoolReleaseEntry(pool, entry);
+        return NULL;
+    }
+
+    compiled->table = table;
+    compiled->pool = pool;
+    compiled->entry = entry;
+
+    tableGetInfo(table, &info);
+    if (!(compiled->visitOf = malloc((info.states + 1) * sizeof(uint32_t)))) {
+        fprintf(stderr, "Error allocating memory\n");
+        _fsmCompiledDestroy(compiled);
+        return NULL;
+    }
+
+    /* Backwards, so a row counts as the first of its states */
+    for (size_t i = compiled->statesCount; i > 0; i--) {
+        if (stateOf[i - 1] != TABLE_REJECT) {
+            compiled->visitOf[stateOf[i - 1]] = i - 1;
+        }
+    }
+
+    return compiled;
+}
+
+FsmCompiled *fsmCompiledRetain(FsmCompiled *compiled) {
+    __atomic_add_fetch(&compiled->refs, 1, __ATOMIC_RELAXED);
+    return compiled;
+}
+
+/*
+* Drops one reference, the last one frees the compiled FSM.
+*/
+void fsmCompiledRelease(FsmCompiled **compiled) {
+    if (*compiled && __atomic_sub_fetch(&(*compiled)->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        _fsmCompiledDestroy(*compiled);
+    }
+
+    *compiled = NULL;
+}
+
+const char *fsmCompiledGetName(const FsmCompiled *compiled) {
+    return compiled->name;
+}
+
+uint64_t fsmCompiledGetId(const FsmCompiled *compiled) {
+    return compiled->id;
+}
+
+size_t fsmCompiledGetStatesCount(const FsmCompiled *compiled) {
+    return compiled->statesCount;
+}
+
+const char *fsmCompiledGetStateName(const FsmCompiled *compiled, size_t index) {
+    if (index >= compiled->statesCount) {
+        return NULL;
+    }
+
+    return compiled->states[index];
+}
+
+void fsmCompiledGetTableInfo(const FsmCompiled *compiled, FsmTableInfo *info) {
+    tableGetInfo(compiled->table, info);
+}
+
+int fsmCompiledCheck(const FsmCompiled *compiled, const char *input, size_t len) {
+    return tableCheck(compiled->table, input, len);
+}
+
+/*
+* Same as fsmCompiledCheck, adding to the caller's counters. stateVisits
+* must hold fsmCompiledGetStatesCount entries, set in statesCount.
+*/
+int fsmCompiledCheckStats(const FsmCompiled *compiled, const char *input, size_t len, FsmStats *stats) {
+    if (!stats->stateVisits || stats->statesCount < compiled->statesCount) {
+        fprintf(stderr, "Error stats need %zu state visit counters\n", compiled->statesCount);
+        return 0;
+    }
+
+    return tableCheckStats(compiled->table, input, len, stats, compiled->visitOf);
+}
+
+FsmState fsmCompiledStart(const FsmCompiled *compiled) {
+    return tableStart(compiled->table);
+}
+
+/*
+* Continues a match with the next piece of its input.
+*/
+FsmState fsmCompiledRun(const FsmCompiled *compiled, FsmState state, const char *input, size_t len) {
+    size_t consumed;
+
+    return tableRun(compiled->table, state, input, len, &consumed);
+}
+
+int fsmCompiledAccepts(const FsmCompiled *compiled, FsmState state) {
+    return tableAccepts(compiled->table, state);
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+static FsmCompiled *_fsmCompiledCreateNames(Fsm *fsm) {
+    size_t len = sizeof(FsmCompiled);
+    size_t statesCount = fsmGetStatesCount(fsm);
+
+    FsmCompiled *compiled = malloc(len);
+    if (!compiled) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    memset(compiled, 0, len);
+
+    compiled->refs = 1;
+    compiled->id = __atomic_add_fetch(&_fsmCompiledLastId, 1, __ATOMIC_RELAXED);
+    compiled->statesCount = statesCount;
+    compiled->name = strdup(fsmGetName(fsm));
+    compiled->states = calloc(statesCount + 1, sizeof(char *));
+
+    if (!compiled->name || !compiled->states) {
+        fprintf(stderr, "Error allocating memory\n");
+        _fsmCompiledDestroy(compiled);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < statesCount; i++) {
+        if (!(compiled->states[i] = strdup(fsmGetStateName(fsm, i)))) {
+            fprintf(stderr, "Error allocating memory\n");
+            _fsmCompiledDestroy(compiled);
+            return NULL;
+        }
+    }
+
+    return compiled;
+}
+
+static void _fsmCompiledDestroy(FsmCompiled *compiled) {
+    if (compiled->states) {
+        for (size_t i = 0; i < compiled->statesCount; i++) {
+            free(compiled->states[i]);
+        }
+    }
+
+    if (compiled->pool) {
+        fsmPoolReleaseEntry(compiled->pool, compiled->entry);
+    } else {
+        tableDestroy(&compiled->table);
+    }
+    free(compiled->visitOf);
+    free(compiled->states);
+    free(compiled->name);
+    free(compiled);
+}
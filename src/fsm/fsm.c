@@ -3,36 +3,49 @@
 #include <string.h>
 
 #include "fsm.h"
+#include "table.h"
+#include "nfa.h"
 
-#define MAX_STATES 256
-#define MAX_ALPHABET 36
-#define MAX_TRANSITIONS MAX_STATES * MAX_ALPHABET
-
-typedef struct STransition {
-    char *from;
-    char c;
-    char *to;
-} Transition;
+#define MAX_STATES (1 << 20)
+#define MAX_ALPHABET 256
+#define MAX_TRANSITIONS (MAX_STATES * MAX_ALPHABET)
 
 struct SFsm {
     char *name;
-    char *states[MAX_STATES];
+    char **states;
     size_t statesCount;
+    size_t statesCapacity;
+    int *stateSlots;
+    size_t stateSlotsCount;
     char alphabet[MAX_ALPHABET];
+    int symbolIndex[256];
     size_t alphabetCount;
-    Transition transitions[MAX_TRANSITIONS];
+    Transition *transitions;
     size_t transitionsCount;
-    char *startState;
-    char *acceptStates[MAX_STATES];
+    size_t transitionsCapacity;
+    int startState;
+    char *acceptStates;
     size_t acceptStatesCount;
+    FsmLayout layout;
+    FsmOrder order;
+    int nondeterministic;
+    size_t *profileCounts;
+    size_t profileCountsSize;
+    Table *table;
+    Nfa *nfa;
+    int statsEnabled;
+    FsmStats stats;
 };
 
-int _stringInArray(char *array[], size_t size, char *value);
-int _charInArray(char array[], size_t size, char value);
+int _fsmStateIndex(Fsm *fsm, char *state);
+int _fsmGrowStates(Fsm *fsm);
+size_t _fsmHashName(const char *name);
 int _fsmStateExists(Fsm *fsm, char *state);
 int _fsmSymbolExists(Fsm *fsm, char c);
-char *_fsmGetNextState(Fsm *fsm, char *state, char c);
-int _fsmCountTransitions(Fsm *fsm, char *state, char c);
+void _fsmInvalidate(Fsm *fsm);
+int _fsmReserveStats(Fsm *fsm);
+uint32_t *_fsmOrderByProfile(Fsm *fsm, const TableSource *source);
+int _fsmAddDiagnostic(FsmValidation *validation, FsmDiagnosticType type, char *state, char symbol, int count);
 
 /*****************************************************************************
 *                              PUBLIC FUNCTIONS                              *
@@ -48,7 +61,13 @@ Fsm *fsmCreate(char *name) {
     fsm->statesCount = 0;
     fsm->alphabetCount = 0;
     fsm->transitionsCount = 0;
-    fsm->startState = NULL;
+    fsm->startState = -1;
+    fsm->layout = FSM_LAYOUT_AUTO;
+    fsm->order = FSM_ORDER_DEFINITION;
+
+    for (size_t i = 0; i < 256; i++) {
+        fsm->symbolIndex[i] = -1;
+    }
     fsm->acceptStatesCount = 0;
 
     return fsm;
@@ -60,10 +79,22 @@ char *fsmGetName(Fsm *fsm) {
 
 void fsmDestroy(Fsm **fsm) {
     if (*fsm) {
+        tableDestroy(&(*fsm)->table);
+        nfaDestroy(&(*fsm)->nfa);
+        for (size_t i = 0; i < (*fsm)->statesCount; i++) {
+            free((*fsm)->states[i]);
+        }
+        free((*fsm)->name);
+        free((*fsm)->states);
+        free((*fsm)->stateSlots);
+        free((*fsm)->acceptStates);
+        free((*fsm)->transitions);
+        free((*fsm)->stats.stateVisits);
+        free((*fsm)->profileCounts);
         free(*fsm);
     }
 
-    fsm = NULL;
+    *fsm = NULL;
 }
 
 int fsmAddState(Fsm *fsm, char *state) {
@@ -75,11 +106,38 @@ int fsmAddState(Fsm *fsm, char *state) {
         return 1;
     }
 
+    if (fsm->statesCount >= fsm->statesCapacity && _fsmGrowStates(fsm) != 0) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+
+    _fsmInvalidate(fsm);
+
+    size_t mask = fsm->stateSlotsCount - 1;
+    size_t slot = _fsmHashName(state) & mask;
+    while (fsm->stateSlots[slot] >= 0) {
+        slot = (slot + 1) & mask;
+    }
+
+    fsm->stateSlots[slot] = fsm->statesCount;
     fsm->states[fsm->statesCount] = state;
+    fsm->acceptStates[fsm->statesCount] = 0;
     fsm->statesCount++;
     return 0;
 }
 
+size_t fsmGetStatesCount(Fsm *fsm) {
+    return fsm->statesCount;
+}
+
+char *fsmGetStateName(Fsm *fsm, size_t index) {
+    if (index >= fsm->statesCount) {
+        return NULL;
+    }
+
+    return fsm->states[index];
+}
+
 int fsmAddToAlphabet(Fsm *fsm, char c) {
     if (fsm->alphabetCount >= MAX_ALPHABET) {
         fprintf(stderr, "Error max size of alphabet is %d\n", MAX_ALPHABET);
@@ -89,171 +147,665 @@ int fsmAddToAlphabet(Fsm *fsm, char c) {
         return 1;
     }
 
+    _fsmInvalidate(fsm);
     fsm->alphabet[fsm->alphabetCount] = c;
+    fsm->symbolIndex[(unsigned char)c] = fsm->alphabetCount;
     fsm->alphabetCount++;
     return 0;
 }
 
 int fsmAddTransition(Fsm *fsm, char *from, char c, char *to) {
+    int fromIndex = _fsmStateIndex(fsm, from);
+    int toIndex = _fsmStateIndex(fsm, to);
+
     if (fsm->transitionsCount >= MAX_TRANSITIONS) {
         fprintf(stderr, "Error max size of transitions is %d\n", MAX_TRANSITIONS);
         return 1;
-    } else if (!_fsmStateExists(fsm, from)) {
+    } else if (fromIndex < 0) {
         fprintf(stderr, "Error state '%s' does not exist\n", from);
         return 2; // Error code for error in state from
     } else if (!_fsmSymbolExists(fsm, c)) {
         fprintf(stderr, "Error symbol '%c' does not exist in the alphabet\n", c);
         return 3; // Error code for error in symbol
-    } else if (!_fsmStateExists(fsm, to)) {
+    } else if (toIndex < 0) {
         fprintf(stderr, "Error state '%s' does not exist\n", to);
         return 4; // Error code for error in state to
     }
 
+    if (fsm->transitionsCount >= fsm->transitionsCapacity) {
+        size_t capacity = fsm->transitionsCapacity ? fsm->transitionsCapacity * 2 : 64;
+        Transition *grown = realloc(fsm->transitions, capacity * sizeof(Transition));
+
+        if (!grown) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+
+        fsm->transitions = grown;
+        fsm->transitionsCapacity = capacity;
+    }
+
+    _fsmInvalidate(fsm);
+
     Transition t;
-    t.from = from;
+    t.from = fromIndex;
     t.c = c;
-    t.to = to;
+    t.to = toIndex;
 
     fsm->transitions[fsm->transitionsCount] = t;
     fsm->transitionsCount++;
     return 0;
 }
 
-void fsmValidateTransitions(Fsm *fsm) {
-    for (size_t i = 0; i < fsm->statesCount; i++) {
+int fsmValidateTransitions(Fsm *fsm, FsmValidation *validation) {
+    size_t statesCount = fsm->statesCount;
+    size_t alphabetCount = fsm->alphabetCount;
+    int *counts = calloc(statesCount * alphabetCount + 1, sizeof(int));
+    unsigned char *incoming = calloc(statesCount / 8 + 1, 1);
+    FsmValidation local = { NULL, 0, 0 };
+    int failed = 0;
+
+    if (!validation) {
+        validation = &local;
+    }
+
+    validation->diagnostics = NULL;
+    validation->count = 0;
+    validation->capacity = 0;
+
+    if (!counts || !incoming) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(counts);
+        free(incoming);
+        return 1;
+    }
+
+    /* Single pass over the transitions: count every (state, symbol) pair
+     * and mark each destination as having an incoming edge. */
+    for (size_t i = 0; i < fsm->transitionsCount; i++) {
+        Transition t = fsm->transitions[i];
+        int symbol = fsm->symbolIndex[(unsigned char)t.c];
+
+        counts[t.from * alphabetCount + symbol]++;
+        incoming[t.to / 8] |= 1 << (t.to % 8);
+    }
+
+    for (size_t i = 0; i < statesCount && !failed; i++) {
         char *state = fsm->states[i];
 
-        for (size_t j = 0; j < fsm->alphabetCount; j++) {
-            char c = fsm->alphabet[j];
-            int totalTransitions = _fsmCountTransitions(fsm, state, c);
+        for (size_t j = 0; j < alphabetCount && !failed; j++) {
+            int totalTransitions = counts[i * alphabetCount + j];
 
-            if (totalTransitions < 1) {
-                fprintf(stderr, "Error transition from state '%s' with symbol '%c' does not exist\n", state, c);
-                exit(EXIT_FAILURE);
+            if (fsm->nondeterministic) {
+                /* Missing transitions reject, several mean any of them */
+            } else if (totalTransitions < 1) {
+                failed = _fsmAddDiagnostic(validation, FSM_DIAG_MISSING_TRANSITION, state, fsm->alphabet[j], totalTransitions);
             } else if (totalTransitions > 1) {
-                fprintf(stderr, "Error a total of %d transitions were found from state '%s' with symbol '%c'\n", totalTransitions, state, c);
-                exit(EXIT_FAILURE);
+                failed = _fsmAddDiagnostic(validation, FSM_DIAG_DUPLICATE_TRANSITION, state, fsm->alphabet[j], totalTransitions);
             }
         }
 
-        int found = 0;
-        for (size_t i = 0; i < fsm->transitionsCount; i++) {
-            Transition t = fsm->transitions[i];
-
-            if (strcmp(t.to, state) == 0) {
-                found = 1;
-            }
+        if (!failed && !(incoming[i / 8] & (1 << (i % 8)))) {
+            failed = _fsmAddDiagnostic(validation, FSM_DIAG_NO_INCOMING_TRANSITION, state, '\0', 0);
         }
+    }
+
+    free(counts);
+    free(incoming);
+
+    if (failed) {
+        fprintf(stderr, "Error allocating memory\n");
+    }
+
+    int result = failed || validation->count > 0;
+
+    if (validation == &local) {
+        fsmValidationDestroy(&local);
+    }
 
-        if (!found) {
-            fprintf(stderr, "Error there is no transitions to state '%s'\n", state);
-            exit(EXIT_FAILURE);
+    return result;
+}
+
+void fsmValidationPrint(FsmValidation *validation) {
+    for (size_t i = 0; i < validation->count; i++) {
+        FsmDiagnostic d = validation->diagnostics[i];
+
+        switch (d.type) {
+            case FSM_DIAG_MISSING_TRANSITION:
+                fprintf(stderr, "Error transition from state '%s' with symbol '%c' does not exist\n", d.state, d.symbol);
+                break;
+            case FSM_DIAG_DUPLICATE_TRANSITION:
+                fprintf(stderr, "Error a total of %d transitions were found from state '%s' with symbol '%c'\n", d.count, d.state, d.symbol);
+                break;
+            case FSM_DIAG_NO_INCOMING_TRANSITION:
+                fprintf(stderr, "Error there is no transitions to state '%s'\n", d.state);
+                break;
         }
     }
 }
 
+void fsmValidationDestroy(FsmValidation *validation) {
+    if (validation->diagnostics) {
+        free(validation->diagnostics);
+    }
+
+    validation->diagnostics = NULL;
+    validation->count = 0;
+    validation->capacity = 0;
+}
+
 int fsmAddStartState(Fsm *fsm, char *state) {
-    if (fsm->startState) {
+    int index = _fsmStateIndex(fsm, state);
+
+    if (fsm->startState >= 0) {
         fprintf(stderr, "Error start state is already setted\n");
         return 1;
-    } else if (!_fsmStateExists(fsm, state)) {
+    } else if (index < 0) {
         fprintf(stderr, "Error state '%s' does not exist\n", state);
         return 1;
     }
 
-    fsm->startState = state;
+    _fsmInvalidate(fsm);
+    fsm->startState = index;
     return 0;
 }
 
 int fsmAddAcceptState(Fsm *fsm, char *state) {
+    int index = _fsmStateIndex(fsm, state);
+
     if (fsm->acceptStatesCount >= MAX_STATES) {
         fprintf(stderr, "Error max size of accept states is %d\n", MAX_STATES);
         return 1;
-        exit(EXIT_FAILURE);
-    }else if (!_stringInArray(fsm->states, fsm->statesCount, state)) {
+    } else if (index < 0) {
         fprintf(stderr, "Error state '%s' does not exist\n", state);
         return 1;
     }
 
-    fsm->acceptStates[fsm->acceptStatesCount] = state;
+    _fsmInvalidate(fsm);
+    fsm->acceptStates[index] = 1;
     fsm->acceptStatesCount++;
     return 0;
 }
 
+/*
+* Lets a state have several transitions on the same symbol, or none. When
+* some state does, the compile step picks the bit-parallel NFA engine
+* instead of a table; the definition can then only be checked through
+* the builder, with fsmCheck.
+*/
+int fsmSetNondeterministic(Fsm *fsm, int enabled) {
+    _fsmInvalidate(fsm);
+    fsm->nondeterministic = enabled;
+    return 0;
+}
+
+int fsmSetLayout(Fsm *fsm, FsmLayout layout) {
+    if (layout != FSM_LAYOUT_AUTO && layout != FSM_LAYOUT_DENSE && layout != FSM_LAYOUT_CSR) {
+        fprintf(stderr, "Error unknown table layout %d\n", layout);
+        return 1;
+    }
+
+    _fsmInvalidate(fsm);
+    fsm->layout = layout;
+    return 0;
+}
+
+int fsmSetStateOrder(Fsm *fsm, FsmOrder order, FsmProfile *profile) {
+    if (order != FSM_ORDER_DEFINITION && order != FSM_ORDER_BFS && order != FSM_ORDER_PROFILE) {
+        fprintf(stderr, "Error unknown state order %d\n", order);
+        return 1;
+    } else if (order == FSM_ORDER_PROFILE && !profile) {
+        fprintf(stderr, "Error profile order requires a profile\n");
+        return 1;
+    }
+
+    if (order == FSM_ORDER_PROFILE) {
+        size_t *counts = malloc((fsm->statesCount + 1) * sizeof(size_t));
+
+        if (!counts) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+
+        for (size_t i = 0; i < fsm->statesCount; i++) {
+            counts[i] = fsmProfileGetCount(profile, fsm->states[i]);
+        }
+
+        free(fsm->profileCounts);
+        fsm->profileCounts = counts;
+        fsm->profileCountsSize = fsm->statesCount;
+    }
+
+    _fsmInvalidate(fsm);
+    fsm->order = order;
+    return 0;
+}
+
+int fsmCompile(Fsm *fsm) {
+    if (fsm->table || fsm->nfa) {
+        return 0;
+    }
+
+    int choices = fsmHasChoices(fsm);
+    if (choices < 0) {
+        return 1;
+    } else if (choices) {
+        TableSource source;
+        FsmLayout layout;
+
+        fsmGetTableSource(fsm, &source, &layout);
+        return (fsm->nfa = nfaCompile(&source)) ? 0 : 1;
+    }
+
+    if (!(fsm->table = fsmCompileTable(fsm))) {
+        return 1;
+    }
+
+    return 0;
+}
+
+/*
+* Compiles a new table from the builder with its layout and state order,
+* owned by the caller. fsmCompile caches one of these in the builder.
+*/
+Table *fsmCompileTable(Fsm *fsm) {
+    Table *table;
+    TableSource source;
+    FsmLayout layout;
+    int choices = fsmHasChoices(fsm);
+
+    if (choices < 0) {
+        return NULL;
+    } else if (choices) {
+        fprintf(stderr, "Error FSM %s is nondeterministic and has no transition table\n", fsm->name);
+        return NULL;
+    }
+
+    fsmGetTableSource(fsm, &source, &layout);
+
+    uint32_t *order = NULL;
+    if (fsm->order == FSM_ORDER_BFS) {
+        order = tableOrderBfs(&source);
+    } else if (fsm->order == FSM_ORDER_PROFILE) {
+        order = _fsmOrderByProfile(fsm, &source);
+    }
+
+    if (fsm->order != FSM_ORDER_DEFINITION && !order) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+
+    source.order = order;
+    table = tableCompile(&source, layout);
+    free(order);
+
+    if (!table) {
+        fprintf(stderr, "Error allocating memory\n");
+    }
+
+    return table;
+}
+
+/*
+* Describes the builder as it is now for the table compiler, in
+* definition order. The source points into the builder.
+*/
+void fsmGetTableSource(Fsm *fsm, TableSource *source, FsmLayout *layout) {
+    source->statesCount = fsm->statesCount;
+    source->alphabet = fsm->alphabet;
+    source->alphabetCount = fsm->alphabetCount;
+    source->transitions = fsm->transitions;
+    source->transitionsCount = fsm->transitionsCount;
+    source->startState = fsm->startState;
+    source->acceptStates = fsm->acceptStates;
+    source->order = NULL;
+    *layout = fsm->layout;
+}
+
+/*
+* Whether a nondeterministic builder really has a state with two
+* different targets on one symbol. Returns -1 when memory runs out.
+*/
+int fsmHasChoices(Fsm *fsm) {
+    size_t cellsCount = fsm->statesCount * fsm->alphabetCount;
+    int *targets;
+    int choices = 0;
+
+    if (!fsm->nondeterministic) {
+        return 0;
+    }
+
+    if (!(targets = malloc((cellsCount + 1) * sizeof(int)))) {
+        fprintf(stderr, "Error allocating memory\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < cellsCount; i++) {
+        targets[i] = -1;
+    }
+    for (size_t i = 0; i < fsm->transitionsCount && !choices; i++) {
+        Transition t = fsm->transitions[i];
+        int *target = &targets[t.from * fsm->alphabetCount + fsm->symbolIndex[(unsigned char)t.c]];
+
+        if (*target < 0) {
+            *target = t.to;
+        } else {
+            choices = *target != t.to;
+        }
+    }
+
+    free(targets);
+    return choices;
+}
+
+int fsmGetTableInfo(Fsm *fsm, FsmTableInfo *info) {
+    if (fsmCompile(fsm) != 0) {
+        return 1;
+    }
+
+    if (fsm->nfa) {
+        nfaGetInfo(fsm->nfa, info);
+    } else {
+        tableGetInfo(fsm->table, info);
+    }
+    return 0;
+}
+
+/*
+* Returns 1 if input is accepted, 0 if not and -1 when the FSM does not
+* compile.
+*/
 int fsmCheck(Fsm *fsm, char *input) {
-    char *state = fsm->startState;
+    if (fsmCompile(fsm) != 0) {
+        return -1;
+    }
+
+#ifdef FSM_STATS
+    if (fsm->statsEnabled && _fsmReserveStats(fsm) == 0) {
+        if (fsm->nfa) {
+            return nfaCheckStats(fsm->nfa, input, strlen(input), &fsm->stats);
+        }
+        return tableCheckStats(fsm->table, input, strlen(input), &fsm->stats, NULL);
+    }
+#endif
+
+    if (fsm->nfa) {
+        return nfaCheck(fsm->nfa, input, strlen(input));
+    }
+    return tableCheck(fsm->table, input, strlen(input));
+}
+
+int fsmEnableStats(Fsm *fsm, int enabled) {
+#ifdef FSM_STATS
+    fsm->statsEnabled = enabled;
+    return 0;
+#else
+    (void)fsm;
+
+    if (enabled) {
+        fprintf(stderr, "Error stats support was not compiled in (FSM_STATS)\n");
+        return 1;
+    }
+
+    return 0;
+#endif
+}
+
+int fsmGetStats(Fsm *fsm, FsmStats *stats) {
+    if (_fsmReserveStats(fsm) != 0) {
+        return 1;
+    }
+
+    *stats = fsm->stats;
+    return 0;
+}
+
+/*
+* Walks a sample input and adds the states it visits to the profile,
+* without touching the counters of fsmGetStats.
+*/
+int fsmProfileAddSample(FsmProfile *profile, Fsm *fsm, char *input) {
+    FsmStats stats;
+    int res = 0;
+
+    if (fsmCompile(fsm) != 0) {
+        return 1;
+    }
 
-    for (size_t i = 0; i < strlen(input); i++) {
-        char c = input[i];
-        char *nextState;
+    memset(&stats, 0, sizeof(FsmStats));
+    stats.statesCount = fsm->statesCount;
+    if (!(stats.stateVisits = calloc(fsm->statesCount + 1, sizeof(size_t)))) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
 
-        if (!_charInArray(fsm->alphabet, fsm->alphabetCount, c)) {
-            return 0;
-        } else if (!(nextState = _fsmGetNextState(fsm, state, c))) {
-            return 0;
+    if (fsm->nfa) {
+        nfaCheckStats(fsm->nfa, input, strlen(input), &stats);
+    } else {
+        tableCheckStats(fsm->table, input, strlen(input), &stats, NULL);
+    }
+
+    for (size_t i = 0; i < fsm->statesCount && res == 0; i++) {
+        if (stats.stateVisits[i]) {
+            res = fsmProfileAdd(profile, fsm->states[i], stats.stateVisits[i]);
         }
+    }
+
+    free(stats.stateVisits);
+    return res;
+}
+
+void fsmResetStats(Fsm *fsm) {
+    size_t *stateVisits = fsm->stats.stateVisits;
+    size_t statesCount = fsm->stats.statesCount;
 
-        state = nextState;
+    memset(&fsm->stats, 0, sizeof(FsmStats));
+
+    if (stateVisits) {
+        memset(stateVisits, 0, statesCount * sizeof(size_t));
     }
 
-    return _stringInArray(fsm->acceptStates, fsm->acceptStatesCount, state);
+    fsm->stats.stateVisits = stateVisits;
+    fsm->stats.statesCount = statesCount;
 }
 
 /*****************************************************************************
 *                              PRIVATE FUNCTIONS                             *
 ******************************************************************************/
 
-int _stringInArray(char *array[], size_t size, char *value) {
-    for (size_t i = 0; i < size; i++) {
-        if (strcmp(array[i], value) == 0) {
-            return 1;
+int _fsmStateIndex(Fsm *fsm, char *state) {
+    if (fsm->stateSlotsCount == 0) {
+        return -1;
+    }
+
+    size_t mask = fsm->stateSlotsCount - 1;
+    for (size_t slot = _fsmHashName(state) & mask; fsm->stateSlots[slot] >= 0; slot = (slot + 1) & mask) {
+        int index = fsm->stateSlots[slot];
+
+        if (strcmp(fsm->states[index], state) == 0) {
+            return index;
         }
     }
 
-    return 0;
+    return -1;
 }
 
-int _charInArray(char array[], size_t size, char value) {
-    for (size_t i = 0; i < size; i++) {
-        if (array[i] == value) {
-            return 1;
+/*
+* Doubles the state arrays and rebuilds the name index, an open addressing
+* table kept at most half full.
+*/
+int _fsmGrowStates(Fsm *fsm) {
+    size_t capacity = fsm->statesCapacity ? fsm->statesCapacity * 2 : 64;
+    char **states = realloc(fsm->states, capacity * sizeof(char *));
+
+    if (!states) {
+        return 1;
+    }
+    fsm->states = states;
+
+    char *acceptStates = realloc(fsm->acceptStates, capacity);
+    if (!acceptStates) {
+        return 1;
+    }
+    fsm->acceptStates = acceptStates;
+
+    int *slots = malloc(capacity * 2 * sizeof(int));
+    if (!slots) {
+        return 1;
+    }
+
+    size_t mask = capacity * 2 - 1;
+    for (size_t i = 0; i < capacity * 2; i++) {
+        slots[i] = -1;
+    }
+    for (size_t i = 0; i < fsm->statesCount; i++) {
+        size_t slot = _fsmHashName(fsm->states[i]) & mask;
+
+        while (slots[slot] >= 0) {
+            slot = (slot + 1) & mask;
         }
+        slots[slot] = i;
     }
 
+    free(fsm->stateSlots);
+    fsm->stateSlots = slots;
+    fsm->stateSlotsCount = capacity * 2;
+    fsm->statesCapacity = capacity;
     return 0;
 }
 
+/* FNV-1a */
+size_t _fsmHashName(const char *name) {
+    size_t hash = 2166136261u;
+
+    for (; *name; name++) {
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    }
+
+    return hash;
+}
+
 int _fsmStateExists(Fsm *fsm, char *state) {
-    return _stringInArray(fsm->states, fsm->statesCount, state);
+    return _fsmStateIndex(fsm, state) >= 0;
 }
 
 int _fsmSymbolExists(Fsm *fsm, char c) {
-    return _charInArray(fsm->alphabet, fsm->alphabetCount, c);
+    return fsm->symbolIndex[(unsigned char)c] >= 0;
 }
 
-char *_fsmGetNextState(Fsm *fsm, char *state, char c) {
-    for (size_t i = 0; i < fsm->transitionsCount; i++) {
-        Transition t = fsm->transitions[i];
+Table *fsmGetTable(Fsm *fsm) {
+    if (fsmCompile(fsm) != 0) {
+        return NULL;
+    }
 
-        if (strcmp(t.from, state) == 0 && t.c == c) {
-            return t.to;
-        }
+    if (fsm->nfa) {
+        fprintf(stderr, "Error FSM %s is nondeterministic and has no transition table\n", fsm->name);
     }
 
-    return NULL;
+    return fsm->table;
 }
 
-int _fsmCountTransitions(Fsm *fsm, char *state, char c) {
-    int total = 0;
+void _fsmInvalidate(Fsm *fsm) {
+    tableDestroy(&fsm->table);
+    nfaDestroy(&fsm->nfa);
+}
 
-    for (size_t i = 0; i < fsm->transitionsCount; i++) {
-        Transition t = fsm->transitions[i];
 
-        if (strcmp(t.from, state) == 0 && t.c == c) {
-            total++;
-        }
+/*
+* Grows the visit histogram to cover every state, keeping the counts
+* already collected for the existing ones.
+*/
+int _fsmReserveStats(Fsm *fsm) {
+    if (fsm->stats.stateVisits && fsm->stats.statesCount >= fsm->statesCount) {
+        return 0;
+    }
+
+    size_t *stateVisits = realloc(fsm->stats.stateVisits, (fsm->statesCount + 1) * sizeof(size_t));
+
+    if (!stateVisits) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+
+    for (size_t i = fsm->stats.statesCount; i < fsm->statesCount; i++) {
+        stateVisits[i] = 0;
+    }
+
+    fsm->stats.stateVisits = stateVisits;
+    fsm->stats.statesCount = fsm->statesCount;
+    return 0;
+}
+
+typedef struct SProfileRank {
+    size_t count;
+    size_t rank;
+    uint32_t state;
+} ProfileRank;
+
+static int _compareProfileRank(const void *a, const void *b) {
+    const ProfileRank *x = a;
+    const ProfileRank *y = b;
+
+    if (x->count != y->count) {
+        return x->count > y->count ? -1 : 1;
+    }
+
+    return x->rank < y->rank ? -1 : x->rank > y->rank;
+}
+
+/*
+* Hottest states first. Ties, including every state the profile never
+* saw, keep their breadth-first order so cold rows still follow the
+* shape of the machine.
+*/
+uint32_t *_fsmOrderByProfile(Fsm *fsm, const TableSource *source) {
+    uint32_t *order = tableOrderBfs(source);
+    ProfileRank *ranks = malloc((fsm->statesCount + 1) * sizeof(ProfileRank));
+
+    if (!order || !ranks) {
+        free(order);
+        free(ranks);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < fsm->statesCount; i++) {
+        uint32_t state = order[i];
+
+        ranks[i].count = state < fsm->profileCountsSize ? fsm->profileCounts[state] : 0;
+        ranks[i].rank = i;
+        ranks[i].state = state;
     }
 
-    return total;
+    qsort(ranks, fsm->statesCount, sizeof(ProfileRank), _compareProfileRank);
+
+    for (size_t i = 0; i < fsm->statesCount; i++) {
+        order[i] = ranks[i].state;
+    }
+
+    free(ranks);
+    return order;
 }
 
+int _fsmAddDiagnostic(FsmValidation *validation, FsmDiagnosticType type, char *state, char symbol, int count) {
+    if (validation->count >= validation->capacity) {
+        size_t capacity = validation->capacity ? validation->capacity * 2 : 16;
+        FsmDiagnostic *grown = realloc(validation->diagnostics, capacity * sizeof(FsmDiagnostic));
+
+        if (!grown) {
+            return 1;
+        }
+
+        validation->diagnostics = grown;
+        validation->capacity = capacity;
+    }
+
+    FsmDiagnostic *diagnostics = validation->diagnostics;
+
+    diagnostics[validation->count].type = type;
+    diagnostics[validation->count].state = state;
+    diagnostics[validation->count].symbol = symbol;
+    diagnostics[validation->count].count = count;
+
+    validation->count++;
+    return 0;
+}
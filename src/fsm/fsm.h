@@ -5,17 +5,262 @@
 extern "C" {
 #endif
 
+#include <stdlib.h>
+#include <stdint.h>
+
 typedef struct SFsm Fsm;
+
+typedef enum {
+    FSM_DIAG_MISSING_TRANSITION,
+    FSM_DIAG_DUPLICATE_TRANSITION,
+    FSM_DIAG_NO_INCOMING_TRANSITION
+} FsmDiagnosticType;
+
+typedef struct SFsmDiagnostic {
+    FsmDiagnosticType type;
+    char *state;
+    char symbol;
+    int count;
+} FsmDiagnostic;
+
+/*
+* Result of fsmValidateTransitions: every problem found in the
+* definition, in state order. Release with fsmValidationDestroy.
+*/
+typedef struct SFsmValidation {
+    FsmDiagnostic *diagnostics;
+    size_t count;
+    size_t capacity;
+} FsmValidation;
+
+typedef enum {
+    FSM_LAYOUT_AUTO,
+    FSM_LAYOUT_DENSE,
+    FSM_LAYOUT_CSR
+} FsmLayout;
+
+/*
+* Matcher picked by the compile step: a transition table, or for a
+* nondeterministic definition the bit-parallel simulation of its NFA.
+*/
+typedef enum {
+    FSM_ENGINE_TABLE,
+    FSM_ENGINE_BITPARALLEL
+} FsmEngine;
+
+/*
+* Shape of the compiled transition table. entries counts the stored
+* cells: every cell for a dense table, only the non-default ones for CSR.
+* cellSize is the width in bytes of each stored state number, and
+* accelerated the number of self-loop states the matcher skips through.
+* The bit-parallel engine reports its own shape, see nfaGetInfo.
+*/
+typedef struct SFsmTableInfo {
+    FsmEngine engine;
+    FsmLayout layout;
+    size_t cellSize;
+    size_t states;
+    size_t classes;
+    size_t entries;
+    size_t accelerated;
+    size_t memory;
+} FsmTableInfo;
+
+/*
+* Row order of the compiled table. FSM_ORDER_BFS walks breadth-first from
+* the start state; FSM_ORDER_PROFILE puts the most visited states first.
+*/
+typedef enum {
+    FSM_ORDER_DEFINITION,
+    FSM_ORDER_BFS,
+    FSM_ORDER_PROFILE
+} FsmOrder;
+
+/*
+* Visit counts keyed by state name, so a profile collected on one build
+* of a definition can be saved and reused for the next one.
+*/
+typedef struct SFsmProfile FsmProfile;
+
+/*
+* Matcher counters, collected only when stats support is compiled in
+* (FSM_STATS) and enabled at runtime with fsmEnableStats. stateVisits
+* has statesCount entries indexed like the states in the definition and
+* is owned by the Fsm.
+*/
+typedef struct SFsmStats {
+    size_t bytesProcessed;
+    size_t inputsChecked;
+    size_t accepts;
+    size_t rejectsBadSymbol;
+    size_t rejectsNoTransition;
+    size_t rejectsNotAccepting;
+    size_t statesCount;
+    size_t *stateVisits;
+} FsmStats;
+
+/*
+* Called with the end offset of every match found by a scan. Returning
+* non-zero stops scanning the current chunk.
+*/
+typedef int (*FsmMatchCallback)(size_t end, void *context);
+
+/*
+* Unanchored matcher: finds every offset where some substring ending
+* there is accepted, across any number of chunks. The Fsm must outlive
+* the scanner and must not change while it is in use.
+*/
+typedef struct SFsmScanner FsmScanner;
+
+/*
+* Immutable, reference counted FSM compiled from a builder. It can be
+* checked from any number of threads at once.
+*/
+typedef struct SFsmCompiled FsmCompiled;
+
+/*
+* Position of a resumable match over an FsmCompiled, from
+* fsmCompiledStart and fed with fsmCompiledRun. Once FSM_STATE_REJECT no
+* more input can be accepted.
+*/
+typedef uint32_t FsmState;
+
+#define FSM_STATE_REJECT UINT32_MAX
+
+/*
+* Interns compiled tables by canonical form, so definitions that accept
+* the same strings, whatever their state names, share one table and
+* keep only their own names. Can be used from several threads, and must
+* outlive every FSM compiled through it.
+*/
+typedef struct SFsmPool FsmPool;
+
+/*
+* Keeps the state of a match over one document every few bytes, so that
+* after an edit the document is only checked again from the checkpoint
+* before the edit to where the run meets the previous one.
+*/
+typedef struct SFsmIncremental FsmIncremental;
+
+/*
+* Bounded memo of check results keyed by compiled FSM and input bytes,
+* for streams where the same inputs come back again and again. Inputs
+* longer than FSM_CACHE_MAX_INPUT are never kept.
+*/
+#define FSM_CACHE_MAX_INPUT 256
+
+typedef struct SFsmCache FsmCache;
+
+/*
+* bypassed counts the inputs too long to be looked up.
+*/
+typedef struct SFsmCacheStats {
+    size_t hits;
+    size_t misses;
+    size_t bypassed;
+    size_t evictions;
+    size_t entries;
+    size_t capacity;
+} FsmCacheStats;
+
+/*
+* Publishes one FsmCompiled at a time to reader threads, each through
+* its own FsmReader. Readers never block, replacing the FSM waits until
+* no reader can still see the old one before releasing it.
+*/
+typedef struct SFsmShared FsmShared;
+typedef struct SFsmReader FsmReader;
+
+/*
+* fsmCreate and fsmAddState take ownership of the name they are given,
+* which fsmDestroy frees; fsmAddState only once it succeeds. The other
+* functions taking a state name only read it.
+*/
 Fsm *fsmCreate(char *name);
 char *fsmGetName(Fsm *fsm);
 void fsmDestroy(Fsm **fsm);
 int fsmAddState(Fsm *fsm, char *state);
+size_t fsmGetStatesCount(Fsm *fsm);
+char *fsmGetStateName(Fsm *fsm, size_t index);
 int fsmAddToAlphabet(Fsm *fsm, char c);
 int fsmAddTransition(Fsm *fsm, char *from, char c, char *to);
-void fsmValidateTransitions(Fsm *fsm);
+int fsmValidateTransitions(Fsm *fsm, FsmValidation *validation);
+void fsmValidationPrint(FsmValidation *validation);
+void fsmValidationDestroy(FsmValidation *validation);
 int fsmAddStartState(Fsm *fsm, char *state);
 int fsmAddAcceptState(Fsm *fsm, char *state);
+int fsmSetNondeterministic(Fsm *fsm, int enabled);
+int fsmSetLayout(Fsm *fsm, FsmLayout layout);
+int fsmSetStateOrder(Fsm *fsm, FsmOrder order, FsmProfile *profile);
+int fsmCompile(Fsm *fsm);
+int fsmGetTableInfo(Fsm *fsm, FsmTableInfo *info);
 int fsmCheck(Fsm *fsm, char *input);
+int fsmEnableStats(Fsm *fsm, int enabled);
+int fsmGetStats(Fsm *fsm, FsmStats *stats);
+void fsmResetStats(Fsm *fsm);
+
+FsmScanner *fsmScannerCreate(Fsm *fsm);
+int fsmScannerFeed(FsmScanner *scanner, const char *input, size_t len, FsmMatchCallback callback, void *context);
+size_t fsmScannerGetOffset(FsmScanner *scanner);
+void fsmScannerReset(FsmScanner *scanner);
+void fsmScannerDestroy(FsmScanner **scanner);
+size_t fsmScan(Fsm *fsm, const char *input, size_t len, size_t *ends, size_t capacity);
+
+FsmCompiled *fsmCompiledCreate(Fsm *fsm);
+FsmCompiled *fsmCompiledRetain(FsmCompiled *compiled);
+void fsmCompiledRelease(FsmCompiled **compiled);
+const char *fsmCompiledGetName(const FsmCompiled *compiled);
+size_t fsmCompiledGetStatesCount(const FsmCompiled *compiled);
+const char *fsmCompiledGetStateName(const FsmCompiled *compiled, size_t index);
+void fsmCompiledGetTableInfo(const FsmCompiled *compiled, FsmTableInfo *info);
+int fsmCompiledCheck(const FsmCompiled *compiled, const char *input, size_t len);
+int fsmCompiledCheckStats(const FsmCompiled *compiled, const char *input, size_t len, FsmStats *stats);
+FsmState fsmCompiledStart(const FsmCompiled *compiled);
+FsmState fsmCompiledRun(const FsmCompiled *compiled, FsmState state, const char *input, size_t len);
+int fsmCompiledAccepts(const FsmCompiled *compiled, FsmState state);
+int fsmCompiledCheckBatch(const FsmCompiled *compiled, const char *const *inputs, const size_t *lens, size_t count, int *results, size_t *walked);
+
+FsmPool *fsmPoolCreate(void);
+void fsmPoolDestroy(FsmPool **pool);
+FsmCompiled *fsmPoolCompile(FsmPool *pool, Fsm *fsm);
+size_t fsmPoolGetTablesCount(FsmPool *pool);
+int fsmGetCanonicalHash(Fsm *fsm, uint64_t *hash);
+
+FsmIncremental *fsmIncrementalCreate(FsmCompiled *compiled, size_t interval);
+void fsmIncrementalDestroy(FsmIncremental **incremental);
+int fsmIncrementalSet(FsmIncremental *incremental, const char *input, size_t len);
+int fsmIncrementalEdit(FsmIncremental *incremental, const char *input, size_t len, size_t offset, size_t removed, size_t inserted);
+int fsmIncrementalAccepts(const FsmIncremental *incremental);
+size_t fsmIncrementalGetWalked(const FsmIncremental *incremental);
+
+FsmCache *fsmCacheCreate(size_t capacity);
+void fsmCacheDestroy(FsmCache **cache);
+int fsmCacheCheck(FsmCache *cache, const FsmCompiled *compiled, const char *input, size_t len);
+int fsmCacheLookup(FsmCache *cache, const FsmCompiled *compiled, const char *input, size_t len);
+int fsmCacheInsert(FsmCache *cache, const FsmCompiled *compiled, const char *input, size_t len, int accepted);
+void fsmCacheGetStats(FsmCache *cache, FsmCacheStats *stats);
+
+FsmShared *fsmSharedCreate(FsmCompiled *compiled);
+void fsmSharedSetPool(FsmShared *shared, FsmPool *pool);
+void fsmSharedDestroy(FsmShared **shared);
+void fsmSharedPublish(FsmShared *shared, FsmCompiled *compiled);
+int fsmSharedReload(FsmShared *shared, const char *filename);
+int fsmSharedReloadStart(FsmShared *shared, const char *filename);
+int fsmSharedReloadWait(FsmShared *shared);
+int fsmSharedReloadPoll(FsmShared *shared);
+FsmReader *fsmReaderCreate(FsmShared *shared);
+void fsmReaderDestroy(FsmReader **reader);
+const FsmCompiled *fsmReaderEnter(FsmReader *reader);
+void fsmReaderExit(FsmReader *reader);
+
+FsmProfile *fsmProfileCreate(void);
+void fsmProfileDestroy(FsmProfile **profile);
+int fsmProfileAdd(FsmProfile *profile, char *state, size_t count);
+int fsmProfileAddStats(FsmProfile *profile, Fsm *fsm);
+int fsmProfileAddSample(FsmProfile *profile, Fsm *fsm, char *input);
+size_t fsmProfileGetCount(FsmProfile *profile, char *state);
+int fsmProfileSave(FsmProfile *profile, const char *filename);
+FsmProfile *fsmProfileLoad(const char *filename);
 
 #ifdef __cplusplus
 }
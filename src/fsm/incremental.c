@@ -0,0 +1,241 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fsm.h"
+
+/*
+* State after the first offset bytes of the document.
+*/
+typedef struct SIncrementalCheckpoint {
+    size_t offset;
+    FsmState state;
+} IncrementalCheckpoint;
+
+/*
+* Checkpoints are sorted by offset, the first one at 0. They are about
+* interval bytes apart: an edit keeps the ones before it, walks the
+* edited part adding new ones, and keeps the ones after it, shifted,
+* from where the walk meets one of them in the same state.
+*/
+struct SFsmIncremental {
+    FsmCompiled *compiled;
+    size_t interval;
+    size_t len;
+    FsmState state;
+    size_t walked;
+    IncrementalCheckpoint *checkpoints;
+    size_t checkpointsCount;
+};
+
+static int _fsmIncrementalWalk(FsmIncremental *incremental, const char *input, size_t len, size_t oldCount, size_t keep, size_t resume, size_t delta);
+static size_t _fsmIncrementalFind(const IncrementalCheckpoint *checkpoints, size_t count, size_t offset);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+/*
+* Takes a reference to compiled. A checkpoint is kept every interval
+* bytes of the document.
+*/
+FsmIncremental *fsmIncrementalCreate(FsmCompiled *compiled, size_t interval) {
+    size_t len = sizeof(FsmIncremental);
+
+    if (interval == 0) {
+        fprintf(stderr, "Error checkpoint interval must be positive\n");
+        return NULL;
+    }
+
+    FsmIncremental *incremental = malloc(len);
+    if (!incremental) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    memset(incremental, 0, len);
+
+    incremental->interval = interval;
+    incremental->state = fsmCompiledStart(compiled);
+
+    if (!(incremental->checkpoints = malloc(sizeof(IncrementalCheckpoint)))) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(incremental);
+        return NULL;
+    }
+
+    incremental->checkpoints[0].offset = 0;
+    incremental->checkpoints[0].state = incremental->state;
+    incremental->checkpointsCount = 1;
+    incremental->compiled = fsmCompiledRetain(compiled);
+
+    return incremental;
+}
+
+void fsmIncrementalDestroy(FsmIncremental **incremental) {
+    if (*incremental) {
+        fsmCompiledRelease(&(*incremental)->compiled);
+        free((*incremental)->checkpoints);
+        free(*incremental);
+    }
+
+    *incremental = NULL;
+}
+
+/*
+* Checks a whole new document. Returns 1 if it is accepted, 0 if not and
+* -1 on error, the previous document then staying checked.
+*/
+int fsmIncrementalSet(FsmIncremental *incremental, const char *input, size_t len) {
+    /* Only the first checkpoint, at the start, holds for a new document */
+    if (_fsmIncrementalWalk(incremental, input, len, 1, 1, 0, 0) != 0) {
+        return -1;
+    }
+
+    return fsmCompiledAccepts(incremental->compiled, incremental->state);
+}
+
+/*
+* Checks input, the document after removed bytes at offset were replaced
+* with inserted bytes. Only the part from the checkpoint before offset to
+* where the state meets the one of the previous run is walked. Returns 1
+* if it is accepted, 0 if not and -1 on error, the previous document then
+* staying checked.
+*/
+int fsmIncrementalEdit(FsmIncremental *incremental, const char *input, size_t len, size_t offset, size_t removed, size_t inserted) {
+    if (offset > incremental->len || removed > incremental->len - offset || len != incremental->len - removed + inserted) {
+        fprintf(stderr, "Error edit does not match the document\n");
+        return -1;
+    }
+
+    size_t keep = _fsmIncrementalFind(incremental->checkpoints, incremental->checkpointsCount, offset) + 1;
+
+    if (_fsmIncrementalWalk(incremental, input, len, incremental->checkpointsCount, keep, offset + removed, inserted - removed) != 0) {
+        return -1;
+    }
+
+    return fsmCompiledAccepts(incremental->compiled, incremental->state);
+}
+
+int fsmIncrementalAccepts(const FsmIncremental *incremental) {
+    return fsmCompiledAccepts(incremental->compiled, incremental->state);
+}
+
+/*
+* Bytes walked by the last fsmIncrementalSet or fsmIncrementalEdit.
+*/
+size_t fsmIncrementalGetWalked(const FsmIncremental *incremental) {
+    return incremental->walked;
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+/*
+* Keeps the first keep checkpoints and walks input from the last of them.
+* The first oldCount old checkpoints at or past resume still hold for the
+* same bytes moved by delta (modulo size_t), so the walk stops as soon as
+* it reaches one of them in the same state, the rest of the run being the
+* same. Nothing changes unless it succeeds.
+*/
+static int _fsmIncrementalWalk(FsmIncremental *incremental, const char *input, size_t len, size_t oldCount, size_t keep, size_t resume, size_t delta) {
+    const FsmCompiled *compiled = incremental->compiled;
+    IncrementalCheckpoint *old = incremental->checkpoints;
+    size_t interval = incremental->interval;
+    size_t next = _fsmIncrementalFind(old, oldCount, resume);
+    IncrementalCheckpoint start = old[keep - 1];
+
+    if (next < oldCount && old[next].offset < resume) {
+        next++;
+    }
+    if (next < keep) {
+        next = keep;
+    }
+
+    /* Sized for a walk to the end without meeting any old checkpoint */
+    size_t capacity = keep + (len - start.offset) / interval + (oldCount - next) + 2;
+    IncrementalCheckpoint *checkpoints = malloc(capacity * sizeof(IncrementalCheckpoint));
+
+    if (!checkpoints) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+
+    memcpy(checkpoints, old, keep * sizeof(IncrementalCheckpoint));
+
+    size_t count = keep;
+    size_t offset = start.offset;
+    FsmState state = start.state;
+    FsmState final = FSM_STATE_REJECT;
+    int converged = 0;
+
+    incremental->walked = 0;
+
+    while (offset < len && !converged) {
+        size_t gridStop = start.offset + (count - keep + 1) * interval;
+        size_t stop = gridStop < len ? gridStop : len;
+        int grid = stop == gridStop;
+
+        /* An old checkpoint before the next grid one is also a stop */
+        if (next < oldCount && old[next].offset + delta <= stop) {
+            stop = old[next].offset + delta;
+            grid = 0;
+        }
+
+        state = fsmCompiledRun(compiled, state, input + offset, stop - offset);
+        incremental->walked += stop - offset;
+        offset = stop;
+
+        if (next < oldCount && old[next].offset + delta == offset) {
+            if (old[next].state == state) {
+                converged = 1;
+                final = incremental->state;
+                break;
+            }
+            next++;
+        }
+
+        if (grid && offset < len) {
+            checkpoints[count].offset = offset;
+            checkpoints[count++].state = state;
+        }
+    }
+
+    /* The rest of the old run still holds, shifted */
+    if (converged) {
+        for (; next < oldCount; next++) {
+            if (old[next].offset + delta == checkpoints[count - 1].offset) {
+                continue;
+            }
+            checkpoints[count].offset = old[next].offset + delta;
+            checkpoints[count++].state = old[next].state;
+        }
+        state = final;
+    }
+
+    free(old);
+    incremental->checkpoints = checkpoints;
+    incremental->checkpointsCount = count;
+    incremental->len = len;
+    incremental->state = state;
+    return 0;
+}
+
+/*
+* Index of the last checkpoint at or before offset.
+*/
+static size_t _fsmIncrementalFind(const IncrementalCheckpoint *checkpoints, size_t count, size_t offset) {
+    size_t low = 0, high = count;
+
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+
+        if (checkpoints[middle].offset <= offset) {
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    return low;
+}
@@ -0,0 +1,457 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "nfa.h"
+#include "../simd/simd.h"
+
+typedef int (*NfaRun)(const Nfa *nfa, const unsigned char *input, size_t len);
+
+/*
+* Bit-parallel simulation of a nondeterministic FSM, one bit per state,
+* so the active set fits in words of 64 bits:
+*
+*     next = ((active & shiftable[symbol]) << 1) | follow[symbol](active & residual[symbol])
+*
+* States are numbered depth-first so that most edges go from p to p+1
+* and are taken by the shift. The other edges are looked up a byte of the
+* active set at a time, in the table of that byte and symbol, only for
+* the bytes holding a state that has such edges on the symbol.
+*/
+struct SNfa {
+    NfaRun run;
+    size_t statesCount;
+    size_t words;
+    size_t classesCount;
+    short classOf[256];
+    SimdByteSet foreign;
+    uint64_t start[NFA_MAX_WORDS];
+    uint64_t accept[NFA_MAX_WORDS];
+    uint64_t *shiftable;
+    uint64_t *residual;
+
+    /* 256 successor sets per symbol and byte of the set with such edges */
+    int32_t *chunkSlot;
+    uint64_t *follow;
+
+    uint32_t *stateOf;
+    size_t entriesCount;
+    size_t memory;
+};
+
+static size_t _nfaNumber(const TableSource *source, const uint32_t *outStart, const uint32_t *out, int32_t *numberOf, uint32_t *stateOf);
+static int _nfaBuildFollow(Nfa *nfa, const uint64_t *edges);
+
+/*
+* One byte of input: the shift, then the residual edges, both of the
+* symbol. Returns whether any state is still active.
+*/
+static inline int _nfaStep(const Nfa *nfa, uint64_t *active, short cls, size_t words) {
+    const uint64_t *shiftable = &nfa->shiftable[cls * words];
+    const uint64_t *residual = &nfa->residual[cls * words];
+    const int32_t *chunkSlot = &nfa->chunkSlot[cls * words * 8];
+    uint64_t next[NFA_MAX_WORDS];
+    uint64_t carry = 0, any = 0;
+
+    for (size_t w = 0; w < words; w++) {
+        uint64_t shifted = active[w] & shiftable[w];
+
+        next[w] = (shifted << 1) | carry;
+        carry = shifted >> 63;
+    }
+
+    for (size_t w = 0; w < words; w++) {
+        uint64_t from = active[w] & residual[w];
+
+        while (from) {
+            size_t shift = __builtin_ctzll(from) & ~(size_t)7;
+            size_t slot = chunkSlot[w * 8 + shift / 8];
+            const uint64_t *follow = &nfa->follow[(slot * 256 + ((from >> shift) & 0xff)) * words];
+
+            for (size_t k = 0; k < words; k++) {
+                next[k] |= follow[k];
+            }
+            from &= ~((uint64_t)0xff << shift);
+        }
+    }
+
+    for (size_t w = 0; w < words; w++) {
+        active[w] = next[w];
+        any |= next[w];
+    }
+
+    return any != 0;
+}
+
+static inline int _nfaAccepts(const Nfa *nfa, const uint64_t *active, size_t words) {
+    uint64_t any = 0;
+
+    for (size_t w = 0; w < words; w++) {
+        any |= active[w] & nfa->accept[w];
+    }
+
+    return any != 0;
+}
+
+/*
+* One loop per set width, so the compiler keeps the whole set in
+* registers and unrolls the word loops. The input is already known to be
+* in the alphabet.
+*/
+#define NFA_DEFINE_RUN(WORDS)                                                            \
+static int _nfaRun##WORDS(const Nfa *nfa, const unsigned char *input, size_t len) {     \
+    uint64_t active[WORDS];                                                              \
+                                                                                         \
+    memcpy(active, nfa->start, sizeof(active));                                          \
+    for (size_t i = 0; i < len; i++) {                                                   \
+        short cls = nfa->classOf[input[i]];                                              \
+                                                                                         \
+        if (!_nfaStep(nfa, active, cls, WORDS)) {                                        \
+            return 0;                                                                    \
+        }                                                                                \
+    }                                                                                    \
+                                                                                         \
+    return _nfaAccepts(nfa, active, WORDS);                                              \
+}
+
+NFA_DEFINE_RUN(1)
+NFA_DEFINE_RUN(2)
+NFA_DEFINE_RUN(4)
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+/*
+* Every transition of the source is kept, several for the same state and
+* symbol meaning any of them. Returns NULL when more than NFA_MAX_STATES
+* states are reachable from the start, or when memory runs out.
+*/
+Nfa *nfaCompile(const TableSource *source) {
+    size_t statesCount = source->statesCount;
+    size_t alphabetCount = source->alphabetCount;
+    uint32_t *outStart = calloc(statesCount + 2, sizeof(uint32_t));
+    uint32_t *out = malloc((source->transitionsCount + 1) * sizeof(uint32_t));
+    int32_t *numberOf = malloc((statesCount + 1) * sizeof(int32_t));
+    uint32_t stateOf[NFA_MAX_STATES];
+    uint64_t *edges = NULL;
+    short classOf[256];
+    size_t len = sizeof(Nfa);
+    Nfa *nfa = NULL;
+
+    if (!outStart || !out || !numberOf) {
+        fprintf(stderr, "Error allocating memory\n");
+        goto done;
+    }
+
+    for (size_t i = 0; i < 256; i++) {
+        classOf[i] = -1;
+    }
+    for (size_t i = 0; i < alphabetCount; i++) {
+        classOf[(unsigned char)source->alphabet[i]] = i;
+    }
+    for (size_t i = 0; i < statesCount; i++) {
+        numberOf[i] = -1;
+    }
+
+    /* Transitions grouped by source state, in definition order */
+    for (size_t i = 0; i < source->transitionsCount; i++) {
+        outStart[source->transitions[i].from + 1]++;
+    }
+    for (size_t i = 0; i < statesCount; i++) {
+        outStart[i + 1] += outStart[i];
+    }
+    for (size_t i = 0; i < source->transitionsCount; i++) {
+        out[outStart[source->transitions[i].from]++] = i;
+    }
+    for (size_t i = statesCount; i > 0; i--) {
+        outStart[i] = outStart[i - 1];
+    }
+    outStart[0] = 0;
+
+    size_t numberedCount = _nfaNumber(source, outStart, out, numberOf, stateOf);
+    if (numberedCount > NFA_MAX_STATES) {
+        fprintf(stderr, "Error nondeterministic FSM has more than %d reachable states\n", NFA_MAX_STATES);
+        goto done;
+    }
+
+    if (!(nfa = malloc(len))) {
+        fprintf(stderr, "Error allocating memory\n");
+        goto done;
+    }
+    memset(nfa, 0, len);
+
+    nfa->statesCount = numberedCount;
+    nfa->words = numberedCount <= 64 ? 1 : numberedCount <= 128 ? 2 : 4;
+    nfa->run = nfa->words == 1 ? _nfaRun1 : nfa->words == 2 ? _nfaRun2 : _nfaRun4;
+    nfa->classesCount = alphabetCount;
+    memcpy(nfa->classOf, classOf, sizeof(classOf));
+
+    simdByteSetInit(&nfa->foreign);
+    for (size_t i = 0; i < 256; i++) {
+        if (classOf[i] < 0) {
+            simdByteSetAdd(&nfa->foreign, (unsigned char)i);
+        }
+    }
+
+    size_t words = nfa->words;
+    nfa->shiftable = calloc(alphabetCount * words + 1, sizeof(uint64_t));
+    nfa->residual = calloc(alphabetCount * words + 1, sizeof(uint64_t));
+    nfa->stateOf = malloc((numberedCount + 1) * sizeof(uint32_t));
+    edges = calloc(numberedCount * alphabetCount * words + 1, sizeof(uint64_t));
+
+    if (!nfa->shiftable || !nfa->residual || !nfa->stateOf || !edges) {
+        fprintf(stderr, "Error allocating memory\n");
+        nfaDestroy(&nfa);
+        goto done;
+    }
+
+    if (numberedCount > 0) {
+        nfa->start[0] = 1;
+    }
+
+    for (size_t p = 0; p < numberedCount; p++) {
+        uint32_t state = stateOf[p];
+        uint64_t bit = (uint64_t)1 << (p % 64);
+
+        nfa->stateOf[p] = state;
+        if (source->acceptStates[state]) {
+            nfa->accept[p / 64] |= bit;
+        }
+
+        for (uint32_t k = outStart[state]; k < outStart[state + 1]; k++) {
+            Transition t = source->transitions[out[k]];
+            size_t cls = classOf[(unsigned char)t.c];
+            size_t next = numberOf[t.to];
+            uint64_t *edge = &edges[(p * alphabetCount + cls) * words + next / 64];
+            uint64_t nextBit = (uint64_t)1 << (next % 64);
+
+            if (next == p + 1) {
+                nfa->entriesCount += (nfa->shiftable[cls * words + p / 64] & bit) == 0;
+                nfa->shiftable[cls * words + p / 64] |= bit;
+            } else {
+                nfa->entriesCount += (*edge & nextBit) == 0;
+                nfa->residual[cls * words + p / 64] |= bit;
+                *edge |= nextBit;
+            }
+        }
+    }
+
+    if (_nfaBuildFollow(nfa, edges) != 0) {
+        fprintf(stderr, "Error allocating memory\n");
+        nfaDestroy(&nfa);
+        goto done;
+    }
+
+    nfa->memory += len + 2 * alphabetCount * words * sizeof(uint64_t) + numberedCount * sizeof(uint32_t);
+
+done:
+    free(outStart);
+    free(out);
+    free(numberOf);
+    free(edges);
+    return nfa;
+}
+
+void nfaDestroy(Nfa **nfa) {
+    if (*nfa) {
+        free((*nfa)->shiftable);
+        free((*nfa)->residual);
+        free((*nfa)->chunkSlot);
+        free((*nfa)->follow);
+        free((*nfa)->stateOf);
+        free(*nfa);
+    }
+
+    *nfa = NULL;
+}
+
+/*
+* The whole input is checked against the alphabet first, the steps cost
+* far more than the search.
+*/
+int nfaCheck(Nfa *nfa, const char *input, size_t len) {
+    if (simdFindInSet(&nfa->foreign, input, len) < len) {
+        return 0;
+    }
+
+    return nfa->run(nfa, (const unsigned char *)input, len);
+}
+
+/*
+* Same as nfaCheck, counting a visit for every state active after each
+* byte. Rejects for a symbol without transition once no state is left.
+*/
+int nfaCheckStats(Nfa *nfa, const char *input, size_t len, FsmStats *stats) {
+    uint64_t active[NFA_MAX_WORDS];
+    size_t words = nfa->words;
+
+    stats->inputsChecked++;
+
+    if (nfa->statesCount == 0) {
+        stats->rejectsNoTransition++;
+        return 0;
+    }
+
+    memcpy(active, nfa->start, sizeof(active));
+
+    for (size_t i = 0; i <= len; i++) {
+        for (size_t w = 0; w < words; w++) {
+            for (uint64_t bits = active[w]; bits; bits &= bits - 1) {
+                stats->stateVisits[nfa->stateOf[w * 64 + __builtin_ctzll(bits)]]++;
+            }
+        }
+
+        if (i == len) {
+            break;
+        }
+
+        short cls = nfa->classOf[(unsigned char)input[i]];
+
+        stats->bytesProcessed++;
+
+        if (cls < 0) {
+            stats->rejectsBadSymbol++;
+            return 0;
+        } else if (!_nfaStep(nfa, active, cls, words)) {
+            stats->rejectsNoTransition++;
+            return 0;
+        }
+    }
+
+    if (!_nfaAccepts(nfa, active, words)) {
+        stats->rejectsNotAccepting++;
+        return 0;
+    }
+
+    stats->accepts++;
+    return 1;
+}
+
+/*
+* states counts the states reachable from the start, entries the edges
+* between them and cellSize the bytes of an active set.
+*/
+void nfaGetInfo(Nfa *nfa, FsmTableInfo *info) {
+    info->layout = FSM_LAYOUT_AUTO;
+    info->engine = FSM_ENGINE_BITPARALLEL;
+    info->cellSize = nfa->words * sizeof(uint64_t);
+    info->states = nfa->statesCount;
+    info->classes = nfa->classesCount;
+    info->entries = nfa->entriesCount;
+    info->accelerated = 0;
+    info->memory = nfa->memory;
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+/*
+* Numbers the states reachable from the start depth-first, the first
+* successor of a state right after it when it is new. Stops counting past
+* NFA_MAX_STATES.
+*/
+static size_t _nfaNumber(const TableSource *source, const uint32_t *outStart, const uint32_t *out, int32_t *numberOf, uint32_t *stateOf) {
+    size_t stackCount = 0, stackCapacity = 64;
+    uint32_t *stack = malloc(stackCapacity * sizeof(uint32_t));
+    size_t count = 0;
+
+    if (!stack) {
+        return NFA_MAX_STATES + 1;
+    }
+    if (source->startState >= 0) {
+        stack[stackCount++] = source->startState;
+    }
+
+    while (stackCount > 0) {
+        uint32_t state = stack[--stackCount];
+
+        if (numberOf[state] >= 0) {
+            continue;
+        } else if (count == NFA_MAX_STATES) {
+            count++;
+            break;
+        }
+
+        numberOf[state] = count;
+        stateOf[count++] = state;
+
+        /* Pushed backwards so the first successor is numbered next */
+        for (uint32_t k = outStart[state + 1]; k > outStart[state]; k--) {
+            uint32_t next = source->transitions[out[k - 1]].to;
+
+            if (numberOf[next] >= 0) {
+                continue;
+            }
+            if (stackCount == stackCapacity) {
+                uint32_t *grown = realloc(stack, stackCapacity * 2 * sizeof(uint32_t));
+
+                if (!grown) {
+                    free(stack);
+                    return NFA_MAX_STATES + 1;
+                }
+                stack = grown;
+                stackCapacity *= 2;
+            }
+            stack[stackCount++] = next;
+        }
+    }
+
+    free(stack);
+    return count;
+}
+
+/*
+* Fills the successor sets of every byte value of each chunk holding a
+* state with residual edges on a symbol, each from the value without its
+* lowest bit.
+*/
+static int _nfaBuildFollow(Nfa *nfa, const uint64_t *edges) {
+    size_t words = nfa->words;
+    size_t chunksCount = words * 8;
+    size_t classesCount = nfa->classesCount;
+    size_t slotsCount = 0;
+
+    if (!(nfa->chunkSlot = malloc((classesCount * chunksCount + 1) * sizeof(int32_t)))) {
+        return 1;
+    }
+
+    for (size_t cls = 0; cls < classesCount; cls++) {
+        for (size_t chunk = 0; chunk < chunksCount; chunk++) {
+            int used = (nfa->residual[cls * words + chunk / 8] >> (chunk % 8 * 8)) & 0xff;
+            nfa->chunkSlot[cls * chunksCount + chunk] = used ? (int32_t)slotsCount++ : -1;
+        }
+    }
+
+    if (!(nfa->follow = calloc(slotsCount * 256 * words + 1, sizeof(uint64_t)))) {
+        return 1;
+    }
+
+    for (size_t cls = 0; cls < classesCount; cls++) {
+        const uint64_t *residual = &nfa->residual[cls * words];
+
+        for (size_t chunk = 0; chunk < chunksCount; chunk++) {
+            int32_t slot = nfa->chunkSlot[cls * chunksCount + chunk];
+
+            if (slot < 0) {
+                continue;
+            }
+
+            uint64_t *follow = &nfa->follow[(size_t)slot * 256 * words];
+            for (size_t value = 1; value < 256; value++) {
+                size_t state = chunk * 8 + __builtin_ctz(value);
+                size_t rest = value & (value - 1);
+                int has = state < nfa->statesCount && (residual[state / 64] >> (state % 64) & 1);
+
+                for (size_t w = 0; w < words; w++) {
+                    uint64_t edge = has ? edges[(state * classesCount + cls) * words + w] : 0;
+                    follow[value * words + w] = follow[rest * words + w] | edge;
+                }
+            }
+        }
+    }
+
+    nfa->memory += (classesCount * chunksCount * sizeof(int32_t)) + slotsCount * 256 * words * sizeof(uint64_t);
+    return 0;
+}
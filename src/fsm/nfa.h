@@ -0,0 +1,32 @@
+#ifndef _NFA_H_
+#define _NFA_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "fsm.h"
+#include "table.h"
+
+/*
+* Largest NFA the bit-parallel engine runs, counted in states reachable
+* from the start, one bit of the active set each.
+*/
+#define NFA_MAX_STATES 256
+#define NFA_MAX_WORDS (NFA_MAX_STATES / 64)
+
+typedef struct SNfa Nfa;
+Nfa *nfaCompile(const TableSource *source);
+void nfaDestroy(Nfa **nfa);
+int nfaCheck(Nfa *nfa, const char *input, size_t len);
+int nfaCheckStats(Nfa *nfa, const char *input, size_t len, FsmStats *stats);
+void nfaGetInfo(Nfa *nfa, FsmTableInfo *info);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _NFA_H_
@@ -0,0 +1,281 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "fsm.h"
+#include "table.h"
+
+#define POOL_INITIAL_BUCKETS 64
+
+/*
+* One interned table, the layout it was asked for and the number of
+* compiled FSMs using it. Entries are chained by canonical hash.
+*/
+struct SFsmPoolEntry {
+    uint64_t hash;
+    FsmLayout layout;
+    Table *table;
+    size_t refs;
+    FsmPoolEntry *next;
+};
+
+struct SFsmPool {
+    pthread_mutex_t lock;
+    FsmPoolEntry **buckets;
+    size_t bucketsCount;
+    size_t entriesCount;
+};
+
+static FsmPoolEntry *_fsmPoolFind(FsmPool *pool, const TableCanonical *canonical, FsmLayout layout);
+static int _fsmPoolGrow(FsmPool *pool);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+FsmPool *fsmPoolCreate(void) {
+    size_t len = sizeof(FsmPool);
+
+    FsmPool *pool = malloc(len);
+    if (!pool) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    memset(pool, 0, len);
+
+    pool->bucketsCount = POOL_INITIAL_BUCKETS;
+    pool->buckets = calloc(pool->bucketsCount, sizeof(FsmPoolEntry *));
+
+    if (!pool->buckets) {
+        fprintf(stderr, "Error allocating memory\n");
+        free(pool);
+        return NULL;
+    }
+
+    if (pthread_mutex_init(&pool->lock, NULL) != 0) {
+        fprintf(stderr, "Error creating lock\n");
+        free(pool->buckets);
+        free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+/*
+* Every FSM compiled through the pool must have been released.
+*/
+void fsmPoolDestroy(FsmPool **pool) {
+    if (*pool) {
+        for (size_t i = 0; i < (*pool)->bucketsCount; i++) {
+            FsmPoolEntry *entry = (*pool)->buckets[i];
+
+            while (entry) {
+                FsmPoolEntry *next = entry->next;
+
+                tableDestroy(&entry->table);
+                free(entry);
+                entry = next;
+            }
+        }
+
+        pthread_mutex_destroy(&(*pool)->lock);
+        free((*pool)->buckets);
+        free(*pool);
+    }
+
+    *pool = NULL;
+}
+
+/*
+* Same as fsmCompiledCreate, but the table is the minimal one for the
+* builder's canonical form, shared with every other FSM of the pool that
+* has the same form and layout. The builder's state order is not used.
+*/
+FsmCompiled *fsmPoolCompile(FsmPool *pool, Fsm *fsm) {
+    TableSource source;
+    TableCanonical canonical;
+    FsmLayout layout;
+    FsmPoolEntry *entry;
+    int choices = fsmHasChoices(fsm);
+
+    if (choices < 0) {
+        return NULL;
+    } else if (choices) {
+        fprintf(stderr, "Error FSM %s is nondeterministic and has no transition table\n", fsmGetName(fsm));
+        return NULL;
+    }
+
+    fsmGetTableSource(fsm, &source, &layout);
+
+    if (tableCanonicalize(&source, &canonical) != 0) {
+        fprintf(stderr, "Error allocating memory\n");
+        tableCanonicalDestroy(&canonical);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    entry = _fsmPoolFind(pool, &canonical, layout);
+
+    /* Compiled unlocked, another thread may have added it meanwhile */
+    if (!entry) {
+        pthread_mutex_unlock(&pool->lock);
+        Table *table = tableCompile(&canonical.source, layout);
+        pthread_mutex_lock(&pool->lock);
+
+        if (!table || !(entry = _fsmPoolFind(pool, &canonical, layout))) {
+            size_t len = sizeof(FsmPoolEntry);
+
+            if (table && (entry = malloc(len))) {
+                size_t bucket = canonical.hash & (pool->bucketsCount - 1);
+
+                memset(entry, 0, len);
+                entry->hash = canonical.hash;
+                entry->layout = layout;
+                entry->table = table;
+                entry->next = pool->buckets[bucket];
+                pool->buckets[bucket] = entry;
+                pool->entriesCount++;
+                table = NULL;
+
+                if (pool->entriesCount > pool->bucketsCount) {
+                    _fsmPoolGrow(pool);
+                }
+            }
+        }
+
+        tableDestroy(&table);
+    }
+
+    if (entry) {
+        entry->refs++;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!entry) {
+        fprintf(stderr, "Error allocating memory\n");
+        tableCanonicalDestroy(&canonical);
+        return NULL;
+    }
+
+    FsmCompiled *compiled = fsmCompiledCreateShared(fsm, pool, entry, entry->table, canonical.stateOf);
+    tableCanonicalDestroy(&canonical);
+
+    return compiled;
+}
+
+/*
+* Number of distinct tables in use.
+*/
+size_t fsmPoolGetTablesCount(FsmPool *pool) {
+    pthread_mutex_lock(&pool->lock);
+    size_t count = pool->entriesCount;
+    pthread_mutex_unlock(&pool->lock);
+
+    return count;
+}
+
+/*
+* Hash of the builder's canonical form: equal for definitions accepting
+* the same strings, whatever their state names and order.
+*/
+int fsmGetCanonicalHash(Fsm *fsm, uint64_t *hash) {
+    TableSource source;
+    TableCanonical canonical;
+    FsmLayout layout;
+    int choices = fsmHasChoices(fsm);
+
+    if (choices < 0) {
+        return 1;
+    } else if (choices) {
+        fprintf(stderr, "Error FSM %s is nondeterministic and has no canonical form\n", fsmGetName(fsm));
+        return 1;
+    }
+
+    fsmGetTableSource(fsm, &source, &layout);
+
+    if (tableCanonicalize(&source, &canonical) != 0) {
+        fprintf(stderr, "Error allocating memory\n");
+        tableCanonicalDestroy(&canonical);
+        return 1;
+    }
+
+    *hash = canonical.hash;
+    tableCanonicalDestroy(&canonical);
+    return 0;
+}
+
+/*
+* Drops a compiled FSM's hold on its table, freeing the table with the
+* last one.
+*/
+void fsmPoolReleaseEntry(FsmPool *pool, FsmPoolEntry *entry) {
+    pthread_mutex_lock(&pool->lock);
+
+    if (--entry->refs == 0) {
+        FsmPoolEntry **link = &pool->buckets[entry->hash & (pool->bucketsCount - 1)];
+
+        while (*link != entry) {
+            link = &(*link)->next;
+        }
+        *link = entry->next;
+        pool->entriesCount--;
+
+        tableDestroy(&entry->table);
+        free(entry);
+    }
+
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+/*
+* Called with the lock held. A hash match is confirmed against the table
+* itself.
+*/
+static FsmPoolEntry *_fsmPoolFind(FsmPool *pool, const TableCanonical *canonical, FsmLayout layout) {
+    FsmPoolEntry *entry = pool->buckets[canonical->hash & (pool->bucketsCount - 1)];
+
+    for (; entry; entry = entry->next) {
+        if (entry->hash == canonical->hash && entry->layout == layout && tableEquals(entry->table, &canonical->source)) {
+            return entry;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+* Doubles the buckets. The pool keeps working with the old ones if
+* memory runs out.
+*/
+static int _fsmPoolGrow(FsmPool *pool) {
+    size_t bucketsCount = pool->bucketsCount * 2;
+    FsmPoolEntry **buckets = calloc(bucketsCount, sizeof(FsmPoolEntry *));
+
+    if (!buckets) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < pool->bucketsCount; i++) {
+        FsmPoolEntry *entry = pool->buckets[i];
+
+        while (entry) {
+            FsmPoolEntry *next = entry->next;
+            size_t bucket = entry->hash & (bucketsCount - 1);
+
+            entry->next = buckets[bucket];
+            buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+
+    free(pool->buckets);
+    pool->buckets = buckets;
+    pool->bucketsCount = bucketsCount;
+    return 0;
+}
@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fsm.h"
+
+#define MAX_PROFILE_LINE 1024
+
+typedef struct SProfileEntry {
+    char *state;
+    size_t count;
+} ProfileEntry;
+
+/* Entries are kept sorted by state name */
+struct SFsmProfile {
+    ProfileEntry *entries;
+    size_t entriesCount;
+    size_t entriesCapacity;
+};
+
+static ProfileEntry *_profileFind(FsmProfile *profile, const char *state);
+static int _profileAdd(FsmProfile *profile, const char *state, size_t count);
+static int _compareProfileEntry(const void *a, const void *b);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+FsmProfile *fsmProfileCreate(void) {
+    size_t len = sizeof(FsmProfile);
+
+    FsmProfile *profile = malloc(len);
+    if (!profile) {
+        return NULL;
+    }
+    memset(profile, 0, len);
+
+    return profile;
+}
+
+void fsmProfileDestroy(FsmProfile **profile) {
+    if (*profile) {
+        for (size_t i = 0; i < (*profile)->entriesCount; i++) {
+            free((*profile)->entries[i].state);
+        }
+
+        free((*profile)->entries);
+        free(*profile);
+    }
+
+    *profile = NULL;
+}
+
+/*
+* Adds the visit histogram collected by fsmCheck with stats enabled.
+*/
+int fsmProfileAddStats(FsmProfile *profile, Fsm *fsm) {
+    FsmStats stats;
+
+    if (fsmGetStats(fsm, &stats) != 0) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < stats.statesCount; i++) {
+        if (stats.stateVisits[i] && _profileAdd(profile, fsmGetStateName(fsm, i), stats.stateVisits[i]) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+int fsmProfileAdd(FsmProfile *profile, char *state, size_t count) {
+    return _profileAdd(profile, state, count);
+}
+
+size_t fsmProfileGetCount(FsmProfile *profile, char *state) {
+    ProfileEntry *entry = _profileFind(profile, state);
+
+    return entry ? entry->count : 0;
+}
+
+/*
+* One "<state> <count>" line per state.
+*/
+int fsmProfileSave(FsmProfile *profile, const char *filename) {
+    FILE *file;
+
+    if (!(file = fopen(filename, "w"))) {
+        fprintf(stderr, "Error opening profile '%s'\n", filename);
+        return 1;
+    }
+
+    for (size_t i = 0; i < profile->entriesCount; i++) {
+        fprintf(file, "%s %zu\n", profile->entries[i].state, profile->entries[i].count);
+    }
+
+    if (fclose(file) != 0) {
+        fprintf(stderr, "Error writing profile '%s'\n", filename);
+        return 1;
+    }
+
+    return 0;
+}
+
+FsmProfile *fsmProfileLoad(const char *filename) {
+    FILE *file;
+    char line[MAX_PROFILE_LINE];
+    char state[MAX_PROFILE_LINE];
+    size_t count;
+    size_t lineNumber = 0;
+
+    if (!(file = fopen(filename, "r"))) {
+        fprintf(stderr, "Error opening profile '%s'\n", filename);
+        return NULL;
+    }
+
+    FsmProfile *profile = fsmProfileCreate();
+    if (!profile) {
+        fclose(file);
+        return NULL;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        lineNumber++;
+
+        if (sscanf(line, "%1023s %zu", state, &count) != 2) {
+            fprintf(stderr, "Error malformed profile '%s' at line %zu\n", filename, lineNumber);
+            fsmProfileDestroy(&profile);
+            break;
+        } else if (_profileAdd(profile, state, count) != 0) {
+            fsmProfileDestroy(&profile);
+            break;
+        }
+    }
+
+    fclose(file);
+    return profile;
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+static ProfileEntry *_profileFind(FsmProfile *profile, const char *state) {
+    ProfileEntry key;
+    key.state = (char *)state;
+
+    if (profile->entriesCount == 0) {
+        return NULL;
+    }
+
+    return bsearch(&key, profile->entries, profile->entriesCount, sizeof(ProfileEntry), _compareProfileEntry);
+}
+
+static int _profileAdd(FsmProfile *profile, const char *state, size_t count) {
+    ProfileEntry *entry = _profileFind(profile, state);
+
+    if (entry) {
+        entry->count += count;
+        return 0;
+    }
+
+    if (profile->entriesCount >= profile->entriesCapacity) {
+        size_t capacity = profile->entriesCapacity ? profile->entriesCapacity * 2 : 64;
+        ProfileEntry *grown = realloc(profile->entries, capacity * sizeof(ProfileEntry));
+
+        if (!grown) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+
+        profile->entries = grown;
+        profile->entriesCapacity = capacity;
+    }
+
+    /* Insert in place to keep the entries sorted, saved profiles append */
+    size_t position = profile->entriesCount;
+    if (position > 0 && strcmp(profile->entries[position - 1].state, state) > 0) {
+        position = 0;
+        while (strcmp(profile->entries[position].state, state) < 0) {
+            position++;
+        }
+    }
+
+    char *name = strdup(state);
+    if (!name) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+
+    memmove(&profile->entries[position + 1], &profile->entries[position], (profile->entriesCount - position) * sizeof(ProfileEntry));
+    profile->entries[position].state = name;
+    profile->entries[position].count = count;
+    profile->entriesCount++;
+    return 0;
+}
+
+static int _compareProfileEntry(const void *a, const void *b) {
+    return strcmp(((const ProfileEntry *)a)->state, ((const ProfileEntry *)b)->state);
+}
@@ -0,0 +1,136 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "fsm.h"
+#include "table.h"
+
+/*
+* Largest unanchored DFA worth building. Past it the scanner steps the
+* set of active states instead.
+*/
+#define MAX_SCAN_STATES 4096
+
+struct SFsmScanner {
+    Table *table;
+    Table *unanchored;
+    TableSet *set;
+    uint32_t state;
+    size_t offset;
+};
+
+typedef struct SScanBuffer {
+    size_t *ends;
+    size_t capacity;
+    size_t count;
+} ScanBuffer;
+
+static int _scanCollect(size_t end, void *context);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+FsmScanner *fsmScannerCreate(Fsm *fsm) {
+    size_t len = sizeof(FsmScanner);
+    Table *table = fsmGetTable(fsm);
+
+    if (!table) {
+        return NULL;
+    }
+
+    FsmScanner *scanner = malloc(len);
+    if (!scanner) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    memset(scanner, 0, len);
+
+    scanner->table = table;
+    scanner->unanchored = tableCompileUnanchored(table, MAX_SCAN_STATES);
+
+    if (scanner->unanchored) {
+        scanner->state = tableStart(scanner->unanchored);
+    } else if (!(scanner->set = tableSetCreate(table))) {
+        fprintf(stderr, "Error allocating memory\n");
+        fsmScannerDestroy(&scanner);
+        return NULL;
+    }
+
+    return scanner;
+}
+
+/*
+* Scans the next chunk of the input. Matches may span chunks, offsets
+* count from the first byte fed since the scanner was created or reset.
+*/
+int fsmScannerFeed(FsmScanner *scanner, const char *input, size_t len, FsmMatchCallback callback, void *context) {
+    int stopped;
+
+    if (scanner->unanchored) {
+        stopped = tableScan(scanner->unanchored, &scanner->state, input, len, scanner->offset, callback, context);
+    } else {
+        stopped = tableScanSet(scanner->table, scanner->set, input, len, scanner->offset, callback, context);
+    }
+
+    scanner->offset += len;
+    return stopped;
+}
+
+size_t fsmScannerGetOffset(FsmScanner *scanner) {
+    return scanner->offset;
+}
+
+void fsmScannerReset(FsmScanner *scanner) {
+    if (scanner->unanchored) {
+        scanner->state = tableStart(scanner->unanchored);
+    } else {
+        tableSetClear(scanner->set);
+    }
+
+    scanner->offset = 0;
+}
+
+void fsmScannerDestroy(FsmScanner **scanner) {
+    if (*scanner) {
+        tableDestroy(&(*scanner)->unanchored);
+        tableSetDestroy(&(*scanner)->set);
+        free(*scanner);
+    }
+
+    *scanner = NULL;
+}
+
+/*
+* Writes up to capacity match end offsets to ends and returns how many
+* matches there are in total. Builds a scanner per call, keep one around
+* to scan many buffers.
+*/
+size_t fsmScan(Fsm *fsm, const char *input, size_t len, size_t *ends, size_t capacity) {
+    FsmScanner *scanner = fsmScannerCreate(fsm);
+    ScanBuffer buffer = { ends, capacity, 0 };
+
+    if (!scanner) {
+        return 0;
+    }
+
+    fsmScannerFeed(scanner, input, len, _scanCollect, &buffer);
+    fsmScannerDestroy(&scanner);
+
+    return buffer.count;
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+static int _scanCollect(size_t end, void *context) {
+    ScanBuffer *buffer = context;
+
+    if (buffer->count < buffer->capacity) {
+        buffer->ends[buffer->count] = end;
+    }
+
+    buffer->count++;
+    return 0;
+}
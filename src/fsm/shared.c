@@ -0,0 +1,266 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "fsm.h"
+#include "../parser/parser.h"
+
+#define MAX_SHARED_READERS 64
+#define SHARED_CACHE_LINE 64
+
+/*
+* One per reader thread. epoch is the global epoch seen when the reader
+* entered, 0 while it is outside. Slots sit on their own cache line so
+* readers do not share lines with each other or with the writer.
+*/
+typedef struct SReaderSlot {
+    uint64_t epoch;
+    int claimed;
+} __attribute__((aligned(SHARED_CACHE_LINE))) ReaderSlot;
+
+/*
+* Readers announce the epoch they enter in and load current, they never
+* wait. A publisher swaps current, bumps the epoch and waits until no
+* reader is left in an older epoch before releasing what it replaced.
+* Publishers are serialized by publishLock.
+*/
+struct SFsmShared {
+    FsmCompiled *current;
+    uint64_t epoch;
+    ReaderSlot slots[MAX_SHARED_READERS];
+    pthread_mutex_t publishLock;
+    pthread_t loader;
+    int loading;
+    int loadDone;
+    int loadResult;
+    char *loadFilename;
+    FsmPool *pool;
+};
+
+struct SFsmReader {
+    FsmShared *shared;
+    ReaderSlot *slot;
+};
+
+static void *_fsmSharedLoad(void *shared);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+/*
+* Takes a reference to compiled, which readers see until the first
+* publish or reload.
+*/
+FsmShared *fsmSharedCreate(FsmCompiled *compiled) {
+    FsmShared *shared;
+
+    if (posix_memalign((void **)&shared, SHARED_CACHE_LINE, sizeof(FsmShared)) != 0) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    memset(shared, 0, sizeof(FsmShared));
+
+    if (pthread_mutex_init(&shared->publishLock, NULL) != 0) {
+        fprintf(stderr, "Error creating lock\n");
+        free(shared);
+        return NULL;
+    }
+
+    shared->current = fsmCompiledRetain(compiled);
+    shared->epoch = 1;
+
+    return shared;
+}
+
+/*
+* Waits for a background reload. No reader may be left.
+*/
+void fsmSharedDestroy(FsmShared **shared) {
+    if (*shared) {
+        fsmSharedReloadWait(*shared);
+        fsmCompiledRelease(&(*shared)->current);
+        pthread_mutex_destroy(&(*shared)->publishLock);
+        free(*shared);
+    }
+
+    *shared = NULL;
+}
+
+/*
+* Compiles reloaded definitions through pool, which must outlive the
+* shared FSM. Set it before any reload starts.
+*/
+void fsmSharedSetPool(FsmShared *shared, FsmPool *pool) {
+    shared->pool = pool;
+}
+
+/*
+* Swaps compiled in, taking a reference, and returns once no reader can
+* still see the previous one, which is then released.
+*/
+void fsmSharedPublish(FsmShared *shared, FsmCompiled *compiled) {
+    pthread_mutex_lock(&shared->publishLock);
+
+    FsmCompiled *previous = __atomic_exchange_n(&shared->current, fsmCompiledRetain(compiled), __ATOMIC_SEQ_CST);
+    uint64_t epoch = __atomic_add_fetch(&shared->epoch, 1, __ATOMIC_SEQ_CST);
+
+    for (size_t i = 0; i < MAX_SHARED_READERS; i++) {
+        uint64_t seen;
+
+        while ((seen = __atomic_load_n(&shared->slots[i].epoch, __ATOMIC_SEQ_CST)) != 0 && seen < epoch) {
+            sched_yield();
+        }
+    }
+
+    pthread_mutex_unlock(&shared->publishLock);
+    fsmCompiledRelease(&previous);
+}
+
+/*
+* Parses, compiles and publishes a definition file. On any error the
+* current FSM stays published.
+*/
+int fsmSharedReload(FsmShared *shared, const char *filename) {
+    Fsm *fsm = parserParseFile(filename);
+
+    if (!fsm) {
+        return 1;
+    }
+
+    FsmCompiled *compiled = shared->pool ? fsmPoolCompile(shared->pool, fsm) : fsmCompiledCreate(fsm);
+    fsmDestroy(&fsm);
+
+    if (!compiled) {
+        return 1;
+    }
+
+    fsmSharedPublish(shared, compiled);
+    fsmCompiledRelease(&compiled);
+    return 0;
+}
+
+/*
+* Runs fsmSharedReload on a background thread. Only one reload runs at a
+* time, collect its result with fsmSharedReloadWait or
+* fsmSharedReloadPoll.
+*/
+int fsmSharedReloadStart(FsmShared *shared, const char *filename) {
+    if (shared->loading) {
+        fprintf(stderr, "Error a reload is already running\n");
+        return 1;
+    }
+
+    if (!(shared->loadFilename = strdup(filename))) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+
+    __atomic_store_n(&shared->loadDone, 0, __ATOMIC_RELAXED);
+
+    if (pthread_create(&shared->loader, NULL, _fsmSharedLoad, shared) != 0) {
+        fprintf(stderr, "Error starting reload\n");
+        free(shared->loadFilename);
+        shared->loadFilename = NULL;
+        return 1;
+    }
+
+    shared->loading = 1;
+    return 0;
+}
+
+/*
+* Returns the result of the last background reload, 0 when none ran.
+*/
+int fsmSharedReloadWait(FsmShared *shared) {
+    if (shared->loading) {
+        pthread_join(shared->loader, NULL);
+        free(shared->loadFilename);
+        shared->loadFilename = NULL;
+        shared->loading = 0;
+        return shared->loadResult;
+    }
+
+    return 0;
+}
+
+/*
+* Same as fsmSharedReloadWait but never blocks, returns -1 while the
+* background reload is still running.
+*/
+int fsmSharedReloadPoll(FsmShared *shared) {
+    if (shared->loading && !__atomic_load_n(&shared->loadDone, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+
+    return fsmSharedReloadWait(shared);
+}
+
+/*
+* Claims one of the reader slots, for use by a single thread. Returns
+* NULL when all of them are taken.
+*/
+FsmReader *fsmReaderCreate(FsmShared *shared) {
+    size_t len = sizeof(FsmReader);
+
+    FsmReader *reader = malloc(len);
+    if (!reader) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    memset(reader, 0, len);
+
+    for (size_t i = 0; i < MAX_SHARED_READERS; i++) {
+        int unclaimed = 0;
+
+        if (__atomic_compare_exchange_n(&shared->slots[i].claimed, &unclaimed, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            reader->shared = shared;
+            reader->slot = &shared->slots[i];
+            return reader;
+        }
+    }
+
+    fprintf(stderr, "Error max number of readers is %d\n", MAX_SHARED_READERS);
+    free(reader);
+    return NULL;
+}
+
+void fsmReaderDestroy(FsmReader **reader) {
+    if (*reader) {
+        __atomic_store_n(&(*reader)->slot->epoch, 0, __ATOMIC_RELEASE);
+        __atomic_store_n(&(*reader)->slot->claimed, 0, __ATOMIC_RELEASE);
+        free(*reader);
+    }
+
+    *reader = NULL;
+}
+
+/*
+* Returns the published FSM, valid until fsmReaderExit. Retain it to keep
+* it longer. Never blocks.
+*/
+const FsmCompiled *fsmReaderEnter(FsmReader *reader) {
+    FsmShared *shared = reader->shared;
+
+    __atomic_store_n(&reader->slot->epoch, __atomic_load_n(&shared->epoch, __ATOMIC_ACQUIRE), __ATOMIC_SEQ_CST);
+    return __atomic_load_n(&shared->current, __ATOMIC_SEQ_CST);
+}
+
+void fsmReaderExit(FsmReader *reader) {
+    __atomic_store_n(&reader->slot->epoch, 0, __ATOMIC_RELEASE);
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+static void *_fsmSharedLoad(void *shared) {
+    FsmShared *target = shared;
+
+    target->loadResult = fsmSharedReload(target, target->loadFilename);
+    __atomic_store_n(&target->loadDone, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
@@ -0,0 +1,1143 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "table.h"
+#include "../simd/simd.h"
+
+/*
+* Dense tables bigger than this are worth compressing when they are
+* mostly filled with each row's default target.
+*/
+#define TABLE_DENSE_LIMIT (32 * 1024)
+#define TABLE_CSR_MAX_DENSITY 4
+
+/*
+* A row is accelerated when it loops back to itself on at least this
+* share (1/n) of the alphabet, so the input tends to stay there.
+*/
+#define TABLE_ACCEL_MIN_SHARE 2
+
+/*
+* Bytes checked against the alphabet ahead of each run, small enough to
+* still be cached when they are walked and to bound the check wasted on
+* input rejected early by a missing transition.
+*/
+#define TABLE_RUN_BLOCK 4096
+
+typedef uint32_t (*TableRun)(Table *table, uint32_t state, const unsigned char *input, size_t len, size_t *consumed);
+typedef int (*TableScan)(Table *table, uint32_t *state, const unsigned char *input, size_t len, size_t offset, FsmMatchCallback callback, void *context);
+
+typedef struct STableLoops {
+    TableRun run;
+    TableRun runAccel;
+    TableScan scan;
+    TableScan scanAccel;
+} TableLoops;
+
+struct STable {
+    FsmLayout layout;
+    size_t cellSize;
+    TableRun run;
+    TableScan scan;
+    size_t statesCount;
+    size_t classesCount;
+    short classOf[256];
+    uint32_t start;
+    unsigned char *accept;
+
+    /* Bytes outside the alphabet, found 16 or 32 at a time before a run */
+    SimdByteSet foreign;
+
+    /* Row of every builder state and builder state of every row */
+    uint32_t *rowOf;
+    uint32_t *stateOf;
+
+    /*
+    * Cells, row defaults and targets hold row numbers in cellSize bytes,
+    * the all-ones value of that width meaning reject.
+    */
+
+    /* FSM_LAYOUT_DENSE: statesCount rows of classesCount cells */
+    void *cells;
+
+    /* FSM_LAYOUT_CSR: per row default target plus sorted exceptions */
+    void *rowDefault;
+    uint32_t *rowStart;
+    unsigned char *columns;
+    void *targets;
+    size_t entriesCount;
+
+    /*
+    * Self-loop rows: for each row, -1 or the index of the set of bytes
+    * that leave it. Scanning has its own sets since a byte without
+    * transition sends it back to the start instead of rejecting.
+    */
+    int32_t *runAccel;
+    int32_t *scanAccel;
+    SimdByteSet *accelSets;
+    size_t accelSetsCount;
+
+    size_t memory;
+};
+
+static int _tableBuildOrder(Table *table, const TableSource *source);
+static uint32_t *_tableBuildDense(Table *table, const TableSource *source);
+static size_t _tableRowDefault(const uint32_t *row, size_t classesCount, size_t statesCount, uint32_t *counts, uint32_t *defaultTarget);
+static int _tableBuildCsr(Table *table, const uint32_t *dense);
+static void *_tableNarrow(uint32_t *values, size_t count, size_t cellSize);
+static uint32_t _tableCell(const void *cells, size_t cellSize, size_t index);
+static uint32_t _tableStep(Table *table, uint32_t state, short cls);
+static int _tableBuildAccel(Table *table);
+static int32_t _tableAddAccelSet(Table *table, const SimdByteSet *set);
+
+/*
+* Cell lookups for every layout and cell width. They return TABLE_REJECT
+* whatever the width of the stored reject marker.
+*/
+#define TABLE_DEFINE_STEPS(BITS, TYPE, REJECT)                                           \
+static inline uint32_t _tableStepDense##BITS(const Table *table, size_t state, short cls) { \
+    TYPE next = ((const TYPE *)table->cells)[state * table->classesCount + cls];          \
+    return next == REJECT ? TABLE_REJECT : next;                                         \
+}                                                                                        \
+                                                                                         \
+static inline uint32_t _tableStepCsr##BITS(const Table *table, size_t state, short cls) { \
+    const uint32_t *rowStart = table->rowStart;                                          \
+    const unsigned char *columns = table->columns;                                       \
+    uint32_t k = rowStart[state];                                                        \
+    TYPE next;                                                                           \
+                                                                                         \
+    /* Exceptions are sorted by column, so stop as soon as we pass it */                 \
+    while (k < rowStart[state + 1] && columns[k] < cls) {                                \
+        k++;                                                                             \
+    }                                                                                    \
+    if (k < rowStart[state + 1] && columns[k] == cls) {                                  \
+        next = ((const TYPE *)table->targets)[k];                                        \
+    } else {                                                                             \
+        next = ((const TYPE *)table->rowDefault)[state];                                 \
+    }                                                                                    \
+    return next == REJECT ? TABLE_REJECT : next;                                         \
+}
+
+/*
+* One set of matcher loops per step function, so the hot loops read cells
+* of a fixed layout and size.
+*
+* run goes until the input ends or a byte has no transition and returns
+* the state reached (TABLE_REJECT if it stopped early) with the number of
+* bytes consumed. Its input has already been checked against the
+* alphabet, so it has no per-byte test.
+*
+* scan reports the end offset of every byte after which the table is in
+* an accepting state. A byte outside the alphabet, or without transition,
+* sends it back to the start state.
+*/
+#define TABLE_DEFINE_LOOPS(NAME, STEP)                                                   \
+static uint32_t _tableRun##NAME(Table *table, uint32_t start, const unsigned char *input, size_t len, size_t *consumed) { \
+    const short *classOf = table->classOf;                                               \
+    size_t state = start;                                                                \
+    size_t i = 0;                                                                        \
+                                                                                         \
+    for (; i < len; i++) {                                                               \
+        short cls = classOf[input[i]];                                                   \
+        uint32_t next;                                                                   \
+                                                                                         \
+        if ((next = STEP(table, state, cls)) == TABLE_REJECT) {                          \
+            break;                                                                       \
+        }                                                                                \
+        state = next;                                                                    \
+    }                                                                                    \
+                                                                                         \
+    *consumed = i;                                                                       \
+    return i < len ? TABLE_REJECT : (uint32_t)state;                                     \
+}                                                                                        \
+                                                                                         \
+static int _tableScan##NAME(Table *table, uint32_t *state, const unsigned char *input, size_t len, size_t offset, FsmMatchCallback callback, void *context) { \
+    const short *classOf = table->classOf;                                               \
+    const unsigned char *accept = table->accept;                                         \
+    uint32_t start = table->start;                                                       \
+    uint32_t current = *state;                                                           \
+                                                                                         \
+    for (size_t i = 0; i < len; i++) {                                                   \
+        short cls = classOf[input[i]];                                                   \
+                                                                                         \
+        if (cls < 0 || (current = STEP(table, current, cls)) == TABLE_REJECT) {          \
+            current = start;                                                             \
+        } else if (accept[current] && callback(offset + i + 1, context) != 0) {          \
+            *state = current;                                                            \
+            return 1;                                                                    \
+        }                                                                                \
+    }                                                                                    \
+                                                                                         \
+    *state = current;                                                                    \
+    return 0;                                                                            \
+}                                                                                        \
+                                                                                         \
+static uint32_t _tableRunAccel##NAME(Table *table, uint32_t start, const unsigned char *input, size_t len, size_t *consumed) { \
+    const short *classOf = table->classOf;                                               \
+    const int32_t *accel = table->runAccel;                                              \
+    const SimdByteSet *sets = table->accelSets;                                          \
+    size_t state = start;                                                                \
+    size_t i = 0;                                                                        \
+                                                                                         \
+    while (i < len) {                                                                    \
+        short cls = classOf[input[i]];                                                   \
+        uint32_t next;                                                                   \
+                                                                                         \
+        if ((next = STEP(table, state, cls)) == TABLE_REJECT) {                          \
+            break;                                                                       \
+        }                                                                                \
+        i++;                                                                             \
+                                                                                         \
+        /* Only search once the state loops, short runs cost a step */                   \
+        if (next == state && accel[state] >= 0) {                                        \
+            i += simdFindInSet(&sets[accel[state]], (const char *)input + i, len - i);   \
+        }                                                                                \
+        state = next;                                                                    \
+    }                                                                                    \
+                                                                                         \
+    *consumed = i;                                                                       \
+    return i < len ? TABLE_REJECT : (uint32_t)state;                                     \
+}                                                                                        \
+                                                                                         \
+static int _tableScanAccel##NAME(Table *table, uint32_t *state, const unsigned char *input, size_t len, size_t offset, FsmMatchCallback callback, void *context) { \
+    const short *classOf = table->classOf;                                               \
+    const unsigned char *accept = table->accept;                                         \
+    const int32_t *accel = table->scanAccel;                                             \
+    const SimdByteSet *sets = table->accelSets;                                          \
+    uint32_t start = table->start;                                                       \
+    uint32_t current = *state;                                                           \
+                                                                                         \
+    for (size_t i = 0; i < len; i++) {                                                   \
+        short cls = classOf[input[i]];                                                   \
+        uint32_t previous = current;                                                     \
+                                                                                         \
+        if (cls < 0 || (current = STEP(table, current, cls)) == TABLE_REJECT) {          \
+            current = start;                                                             \
+        } else if (accept[current] && callback(offset + i + 1, context) != 0) {          \
+            *state = current;                                                            \
+            return 1;                                                                    \
+        }                                                                                \
+                                                                                         \
+        if (current == previous && accel[current] >= 0) {                                \
+            i += simdFindInSet(&sets[accel[current]], (const char *)input + i + 1, len - i - 1); \
+        }                                                                                \
+    }                                                                                    \
+                                                                                         \
+    *state = current;                                                                    \
+    return 0;                                                                            \
+}
+
+TABLE_DEFINE_STEPS(8, uint8_t, UINT8_MAX)
+TABLE_DEFINE_STEPS(16, uint16_t, UINT16_MAX)
+TABLE_DEFINE_STEPS(32, uint32_t, UINT32_MAX)
+
+TABLE_DEFINE_LOOPS(Dense8, _tableStepDense8)
+TABLE_DEFINE_LOOPS(Dense16, _tableStepDense16)
+TABLE_DEFINE_LOOPS(Dense32, _tableStepDense32)
+TABLE_DEFINE_LOOPS(Csr8, _tableStepCsr8)
+TABLE_DEFINE_LOOPS(Csr16, _tableStepCsr16)
+TABLE_DEFINE_LOOPS(Csr32, _tableStepCsr32)
+
+#define TABLE_LOOPS(NAME) { _tableRun##NAME, _tableRunAccel##NAME, _tableScan##NAME, _tableScanAccel##NAME }
+
+/* Indexed by layout (dense, CSR) and then by log2 of the cell size */
+static const TableLoops _tableLoops[2][3] = {
+    { TABLE_LOOPS(Dense8), TABLE_LOOPS(Dense16), TABLE_LOOPS(Dense32) },
+    { TABLE_LOOPS(Csr8), TABLE_LOOPS(Csr16), TABLE_LOOPS(Csr32) }
+};
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+Table *tableCompile(const TableSource *source, FsmLayout layout) {
+    size_t len = sizeof(Table);
+
+    Table *table = malloc(len);
+    if (!table) {
+        return NULL;
+    }
+    memset(table, 0, len);
+
+    table->statesCount = source->statesCount;
+    table->classesCount = source->alphabetCount;
+
+    for (size_t i = 0; i < 256; i++) {
+        table->classOf[i] = -1;
+    }
+    for (size_t i = 0; i < source->alphabetCount; i++) {
+        table->classOf[(unsigned char)source->alphabet[i]] = i;
+    }
+
+    simdByteSetInit(&table->foreign);
+    for (size_t i = 0; i < 256; i++) {
+        if (table->classOf[i] < 0) {
+            simdByteSetAdd(&table->foreign, (unsigned char)i);
+        }
+    }
+
+    if (_tableBuildOrder(table, source) != 0) {
+        tableDestroy(&table);
+        return NULL;
+    }
+
+    table->start = source->startState < 0 ? TABLE_REJECT : table->rowOf[source->startState];
+    table->accept = malloc(source->statesCount + 1);
+    uint32_t *dense = _tableBuildDense(table, source);
+
+    if (!table->accept || !dense) {
+        free(dense);
+        tableDestroy(&table);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < table->statesCount; i++) {
+        table->accept[i] = source->acceptStates[table->stateOf[i]];
+    }
+
+    /* Smallest cell that holds every row number plus the reject marker */
+    if (table->statesCount < UINT8_MAX) {
+        table->cellSize = sizeof(uint8_t);
+    } else if (table->statesCount < UINT16_MAX) {
+        table->cellSize = sizeof(uint16_t);
+    } else {
+        table->cellSize = sizeof(uint32_t);
+    }
+
+    if (layout == FSM_LAYOUT_AUTO) {
+        size_t denseBytes = table->statesCount * table->classesCount * table->cellSize;
+        uint32_t *counts = calloc(table->statesCount + 1, sizeof(uint32_t));
+        size_t entries = 0;
+
+        if (!counts) {
+            free(dense);
+            tableDestroy(&table);
+            return NULL;
+        }
+
+        for (size_t i = 0; i < table->statesCount; i++) {
+            uint32_t defaultTarget;
+            entries += _tableRowDefault(dense + i * table->classesCount, table->classesCount, table->statesCount, counts, &defaultTarget);
+        }
+        free(counts);
+
+        int sparse = entries * TABLE_CSR_MAX_DENSITY < table->statesCount * table->classesCount;
+        layout = sparse && denseBytes > TABLE_DENSE_LIMIT ? FSM_LAYOUT_CSR : FSM_LAYOUT_DENSE;
+    }
+
+    table->layout = layout;
+    table->memory = len + table->statesCount + 1 + 2 * table->statesCount * sizeof(uint32_t);
+
+    if (layout == FSM_LAYOUT_CSR) {
+        int res = _tableBuildCsr(table, dense);
+        free(dense);
+
+        if (res != 0) {
+            tableDestroy(&table);
+            return NULL;
+        }
+    } else {
+        if (!(table->cells = _tableNarrow(dense, table->statesCount * table->classesCount, table->cellSize))) {
+            tableDestroy(&table);
+            return NULL;
+        }
+        table->memory += table->statesCount * table->classesCount * table->cellSize;
+    }
+
+    if (_tableBuildAccel(table) != 0) {
+        tableDestroy(&table);
+        return NULL;
+    }
+
+    size_t widthIndex = table->cellSize == sizeof(uint8_t) ? 0 : table->cellSize == sizeof(uint16_t) ? 1 : 2;
+    const TableLoops *loops = &_tableLoops[layout == FSM_LAYOUT_CSR][widthIndex];
+
+    table->run = table->runAccel ? loops->runAccel : loops->run;
+    table->scan = table->scanAccel ? loops->scanAccel : loops->scan;
+
+    return table;
+}
+
+void tableDestroy(Table **table) {
+    if (*table) {
+        free((*table)->accept);
+        free((*table)->rowOf);
+        free((*table)->stateOf);
+        free((*table)->cells);
+        free((*table)->rowDefault);
+        free((*table)->rowStart);
+        free((*table)->columns);
+        free((*table)->targets);
+        free((*table)->runAccel);
+        free((*table)->scanAccel);
+        free((*table)->accelSets);
+        free(*table);
+    }
+
+    *table = NULL;
+}
+
+int tableCheck(Table *table, const char *input, size_t len) {
+    size_t consumed;
+    uint32_t state = table->start;
+
+    if (state == TABLE_REJECT) {
+        return 0;
+    }
+
+    state = tableRun(table, state, input, len, &consumed);
+    return state != TABLE_REJECT && table->accept[state];
+}
+
+/*
+* Input is checked against the alphabet one block at a time before it
+* is run, so a byte outside of it rejects before its block is walked
+* and the walk itself skips the test. consumed then only counts the
+* blocks before.
+*/
+uint32_t tableRun(Table *table, uint32_t state, const char *input, size_t len, size_t *consumed) {
+    *consumed = 0;
+
+    if (state == TABLE_REJECT) {
+        return len ? TABLE_REJECT : state;
+    }
+
+    while (*consumed < len) {
+        size_t block = len - *consumed < TABLE_RUN_BLOCK ? len - *consumed : TABLE_RUN_BLOCK;
+        const char *start = input + *consumed;
+        size_t walked;
+
+        if (simdFindInSet(&table->foreign, start, block) < block) {
+            return TABLE_REJECT;
+        }
+
+        state = table->run(table, state, (const unsigned char *)start, block, &walked);
+        *consumed += walked;
+
+        if (state == TABLE_REJECT) {
+            break;
+        }
+    }
+
+    return state;
+}
+
+uint32_t tableStart(Table *table) {
+    return table->start;
+}
+
+int tableAccepts(Table *table, uint32_t state) {
+    return state != TABLE_REJECT && table->accept[state];
+}
+
+/*
+* Same walk as tableCheck, but records why each input was rejected and
+* which states were visited. stats->stateVisits is indexed like the
+* builder states, whatever order the rows were laid out in, or by
+* visitOf[row] when it is given.
+*/
+int tableCheckStats(Table *table, const char *input, size_t len, FsmStats *stats, const uint32_t *visitOf) {
+    uint32_t state = table->start;
+
+    if (!visitOf) {
+        visitOf = table->stateOf;
+    }
+
+    stats->inputsChecked++;
+
+    if (state == TABLE_REJECT) {
+        stats->rejectsNoTransition++;
+        return 0;
+    }
+
+    stats->stateVisits[visitOf[state]]++;
+
+    for (size_t i = 0; i < len; i++) {
+        short cls = table->classOf[(unsigned char)input[i]];
+
+        stats->bytesProcessed++;
+
+        if (cls < 0) {
+            stats->rejectsBadSymbol++;
+            return 0;
+        } else if ((state = _tableStep(table, state, cls)) == TABLE_REJECT) {
+            stats->rejectsNoTransition++;
+            return 0;
+        }
+
+        stats->stateVisits[visitOf[state]]++;
+    }
+
+    if (!table->accept[state]) {
+        stats->rejectsNotAccepting++;
+        return 0;
+    }
+
+    stats->accepts++;
+    return 1;
+}
+
+/*
+* Tells whether the table was compiled from a source with these exact
+* states, symbols and transitions, in this order, whatever its layout.
+* The source must have at most one transition per state and symbol.
+*/
+int tableEquals(Table *table, const TableSource *source) {
+    uint32_t start = source->startState < 0 ? TABLE_REJECT : (uint32_t)source->startState;
+    size_t symbols = 0;
+    size_t cells = 0;
+
+    if (table->statesCount != source->statesCount || table->classesCount != source->alphabetCount || table->start != start) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < 256; i++) {
+        symbols += table->classOf[i] >= 0;
+    }
+    for (size_t i = 0; i < source->alphabetCount; i++) {
+        if (table->classOf[(unsigned char)source->alphabet[i]] != (short)i) {
+            return 0;
+        }
+    }
+    if (symbols != source->alphabetCount) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < table->statesCount; i++) {
+        if (table->stateOf[i] != i || !table->accept[i] != !source->acceptStates[i]) {
+            return 0;
+        }
+        for (size_t j = 0; j < table->classesCount; j++) {
+            cells += _tableStep(table, i, j) != TABLE_REJECT;
+        }
+    }
+    if (cells != source->transitionsCount) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < source->transitionsCount; i++) {
+        Transition t = source->transitions[i];
+
+        if (_tableStep(table, t.from, table->classOf[(unsigned char)t.c]) != (uint32_t)t.to) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+void tableGetInfo(Table *table, FsmTableInfo *info) {
+    info->engine = FSM_ENGINE_TABLE;
+    info->layout = table->layout;
+    info->states = table->statesCount;
+    info->classes = table->classesCount;
+    info->entries = table->layout == FSM_LAYOUT_CSR ? table->entriesCount : table->statesCount * table->classesCount;
+    info->cellSize = table->cellSize;
+    info->accelerated = 0;
+    for (size_t i = 0; table->runAccel && i < table->statesCount; i++) {
+        info->accelerated += table->runAccel[i] >= 0;
+    }
+    info->memory = table->memory;
+}
+
+/*
+* Builds the DFA that tracks every match in progress at once: each of its
+* states is the set of rows reached by the matches that started at any
+* earlier offset, and a new match starts before every byte. Returns NULL
+* when more than maxStates sets show up, or when memory runs out.
+*/
+Table *tableCompileUnanchored(Table *table, size_t maxStates) {
+    size_t rows = table->statesCount;
+    size_t classesCount = table->classesCount;
+    size_t slotsCount = 64;
+    size_t setsCount = 0, setsCapacity = 64;
+    size_t poolCount = 0, poolCapacity = 256;
+    char alphabet[256];
+    Table *result = NULL;
+
+    while (slotsCount < maxStates * 2) {
+        slotsCount *= 2;
+    }
+
+    size_t *setStart = malloc((setsCapacity + 1) * sizeof(size_t));
+    uint32_t *pool = malloc(poolCapacity * sizeof(uint32_t));
+    uint32_t *slots = malloc(slotsCount * sizeof(uint32_t));
+    uint32_t *marks = calloc(rows + 1, sizeof(uint32_t));
+    uint32_t *reached = malloc((rows + 1) * sizeof(uint32_t));
+    Transition *transitions = malloc((maxStates * classesCount + 1) * sizeof(Transition));
+    char *accept = malloc(maxStates + 1);
+
+    if (!setStart || !pool || !slots || !marks || !reached || !transitions || !accept) {
+        goto done;
+    }
+
+    for (size_t i = 0; i < 256; i++) {
+        if (table->classOf[i] >= 0) {
+            alphabet[table->classOf[i]] = (char)i;
+        }
+    }
+    for (size_t i = 0; i < slotsCount; i++) {
+        slots[i] = TABLE_REJECT;
+    }
+
+    /* Set 0 is the empty set: nothing matched yet */
+    setStart[0] = 0;
+    setStart[1] = 0;
+    setsCount = 1;
+    slots[2166136261u & (slotsCount - 1)] = 0;
+
+    for (size_t current = 0; current < setsCount; current++) {
+        for (size_t c = 0; c < classesCount; c++) {
+            size_t reachedCount = 0;
+            uint32_t generation = current * classesCount + c + 1;
+
+            for (size_t k = setStart[current]; k <= setStart[current + 1]; k++) {
+                uint32_t from = k < setStart[current + 1] ? pool[k] : table->start;
+                uint32_t to;
+
+                if (from == TABLE_REJECT || (to = _tableStep(table, from, c)) == TABLE_REJECT || marks[to] == generation) {
+                    continue;
+                }
+                marks[to] = generation;
+
+                /* Insertion sort keeps the set canonical, sets are small */
+                size_t position = reachedCount++;
+                while (position > 0 && reached[position - 1] > to) {
+                    reached[position] = reached[position - 1];
+                    position--;
+                }
+                reached[position] = to;
+            }
+
+            size_t hash = 2166136261u;
+            for (size_t k = 0; k < reachedCount; k++) {
+                hash = (hash ^ reached[k]) * 16777619u;
+            }
+
+            size_t slot = hash & (slotsCount - 1);
+            uint32_t found = TABLE_REJECT;
+            for (; slots[slot] != TABLE_REJECT; slot = (slot + 1) & (slotsCount - 1)) {
+                uint32_t candidate = slots[slot];
+                size_t candidateCount = setStart[candidate + 1] - setStart[candidate];
+
+                if (candidateCount == reachedCount && memcmp(pool + setStart[candidate], reached, reachedCount * sizeof(uint32_t)) == 0) {
+                    found = candidate;
+                    break;
+                }
+            }
+
+            if (found == TABLE_REJECT) {
+                if (setsCount >= maxStates) {
+                    goto done;
+                }
+
+                if (setsCount + 1 >= setsCapacity) {
+                    size_t *grown = realloc(setStart, (setsCapacity * 2 + 1) * sizeof(size_t));
+                    if (!grown) {
+                        goto done;
+                    }
+                    setStart = grown;
+                    setsCapacity *= 2;
+                }
+                while (poolCount + reachedCount > poolCapacity) {
+                    uint32_t *grown = realloc(pool, poolCapacity * 2 * sizeof(uint32_t));
+                    if (!grown) {
+                        goto done;
+                    }
+                    pool = grown;
+                    poolCapacity *= 2;
+                }
+
+                memcpy(pool + poolCount, reached, reachedCount * sizeof(uint32_t));
+                poolCount += reachedCount;
+                found = setsCount++;
+                setStart[setsCount] = poolCount;
+                slots[slot] = found;
+            }
+
+            transitions[current * classesCount + c].from = current;
+            transitions[current * classesCount + c].c = alphabet[c];
+            transitions[current * classesCount + c].to = found;
+        }
+    }
+
+    for (size_t i = 0; i < setsCount; i++) {
+        accept[i] = 0;
+
+        for (size_t k = setStart[i]; k < setStart[i + 1] && !accept[i]; k++) {
+            accept[i] = table->accept[pool[k]];
+        }
+    }
+
+    TableSource source;
+    source.statesCount = setsCount;
+    source.alphabet = alphabet;
+    source.alphabetCount = classesCount;
+    source.transitions = transitions;
+    source.transitionsCount = setsCount * classesCount;
+    source.startState = 0;
+    source.acceptStates = accept;
+    source.order = NULL;
+
+    result = tableCompile(&source, FSM_LAYOUT_AUTO);
+
+done:
+    free(setStart);
+    free(pool);
+    free(slots);
+    free(marks);
+    free(reached);
+    free(transitions);
+    free(accept);
+    return result;
+}
+
+int tableScan(Table *table, uint32_t *state, const char *input, size_t len, size_t offset, FsmMatchCallback callback, void *context) {
+    return table->scan(table, state, (const unsigned char *)input, len, offset, callback, context);
+}
+
+struct STableSet {
+    uint32_t *current;
+    uint32_t *next;
+    size_t currentCount;
+    uint32_t *marks;
+    uint32_t generation;
+};
+
+TableSet *tableSetCreate(Table *table) {
+    size_t len = sizeof(TableSet);
+
+    TableSet *set = malloc(len);
+    if (!set) {
+        return NULL;
+    }
+    memset(set, 0, len);
+
+    set->current = malloc((table->statesCount + 1) * sizeof(uint32_t));
+    set->next = malloc((table->statesCount + 1) * sizeof(uint32_t));
+    set->marks = calloc(table->statesCount + 1, sizeof(uint32_t));
+
+    if (!set->current || !set->next || !set->marks) {
+        tableSetDestroy(&set);
+        return NULL;
+    }
+
+    return set;
+}
+
+void tableSetDestroy(TableSet **set) {
+    if (*set) {
+        free((*set)->current);
+        free((*set)->next);
+        free((*set)->marks);
+        free(*set);
+    }
+
+    *set = NULL;
+}
+
+void tableSetClear(TableSet *set) {
+    set->currentCount = 0;
+}
+
+/*
+* Same matches as scanning the unanchored DFA, stepping the set of active
+* rows directly. Slower, but its size never depends on the machine shape.
+*/
+int tableScanSet(Table *table, TableSet *set, const char *input, size_t len, size_t offset, FsmMatchCallback callback, void *context) {
+    for (size_t i = 0; i < len; i++) {
+        short cls = table->classOf[(unsigned char)input[i]];
+        size_t nextCount = 0;
+        int accepted = 0;
+
+        if (cls < 0) {
+            set->currentCount = 0;
+            continue;
+        }
+
+        if (++set->generation == 0) {
+            memset(set->marks, 0, table->statesCount * sizeof(uint32_t));
+            set->generation = 1;
+        }
+
+        for (size_t k = 0; k <= set->currentCount; k++) {
+            uint32_t from = k < set->currentCount ? set->current[k] : table->start;
+            uint32_t to;
+
+            if (from == TABLE_REJECT || (to = _tableStep(table, from, cls)) == TABLE_REJECT || set->marks[to] == set->generation) {
+                continue;
+            }
+
+            set->marks[to] = set->generation;
+            set->next[nextCount++] = to;
+            accepted |= table->accept[to];
+        }
+
+        uint32_t *swap = set->current;
+        set->current = set->next;
+        set->next = swap;
+        set->currentCount = nextCount;
+
+        if (accepted && callback(offset + i + 1, context) != 0) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+* Lists the states in breadth-first order from the start state, following
+* symbols in alphabet order. States that cannot be reached keep their
+* definition order at the end.
+*/
+uint32_t *tableOrderBfs(const TableSource *source) {
+    size_t statesCount = source->statesCount;
+    size_t alphabetCount = source->alphabetCount;
+    uint32_t *order = malloc((statesCount + 1) * sizeof(uint32_t));
+    uint32_t *edges = malloc((statesCount * alphabetCount + 1) * sizeof(uint32_t));
+    unsigned char *seen = calloc(statesCount + 1, 1);
+    short classOf[256];
+    size_t head = 0, tail = 0;
+
+    if (!order || !edges || !seen) {
+        free(order);
+        free(edges);
+        free(seen);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < 256; i++) {
+        classOf[i] = -1;
+    }
+    for (size_t i = 0; i < alphabetCount; i++) {
+        classOf[(unsigned char)source->alphabet[i]] = i;
+    }
+    for (size_t i = 0; i < statesCount * alphabetCount; i++) {
+        edges[i] = TABLE_REJECT;
+    }
+    for (size_t i = 0; i < source->transitionsCount; i++) {
+        Transition t = source->transitions[i];
+        uint32_t *edge = &edges[t.from * alphabetCount + classOf[(unsigned char)t.c]];
+
+        if (*edge == TABLE_REJECT) {
+            *edge = t.to;
+        }
+    }
+
+    if (source->startState >= 0) {
+        order[tail++] = source->startState;
+        seen[source->startState] = 1;
+    }
+
+    while (head < tail) {
+        uint32_t state = order[head++];
+
+        for (size_t j = 0; j < alphabetCount; j++) {
+            uint32_t next = edges[state * alphabetCount + j];
+
+            if (next != TABLE_REJECT && !seen[next]) {
+                seen[next] = 1;
+                order[tail++] = next;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < statesCount; i++) {
+        if (!seen[i]) {
+            order[tail++] = i;
+        }
+    }
+
+    free(edges);
+    free(seen);
+    return order;
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+static int _tableBuildOrder(Table *table, const TableSource *source) {
+    table->rowOf = malloc((table->statesCount + 1) * sizeof(uint32_t));
+    table->stateOf = malloc((table->statesCount + 1) * sizeof(uint32_t));
+
+    if (!table->rowOf || !table->stateOf) {
+        return 1;
+    }
+
+    for (size_t i = 0; i < table->statesCount; i++) {
+        table->stateOf[i] = source->order ? source->order[i] : i;
+        table->rowOf[table->stateOf[i]] = i;
+    }
+
+    return 0;
+}
+
+static uint32_t *_tableBuildDense(Table *table, const TableSource *source) {
+    size_t cellsCount = source->statesCount * source->alphabetCount;
+    uint32_t *cells = malloc((cellsCount + 1) * sizeof(uint32_t));
+
+    if (!cells) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < cellsCount; i++) {
+        cells[i] = TABLE_REJECT;
+    }
+
+    /* The first transition of a (state, symbol) pair wins */
+    for (size_t i = 0; i < source->transitionsCount; i++) {
+        Transition t = source->transitions[i];
+        uint32_t *cell = &cells[table->rowOf[t.from] * source->alphabetCount + table->classOf[(unsigned char)t.c]];
+
+        if (*cell == TABLE_REJECT) {
+            *cell = table->rowOf[t.to];
+        }
+    }
+
+    return cells;
+}
+
+/*
+* Picks the most frequent target of a row as its default and returns how
+* many cells differ from it. counts must hold statesCount + 1 zeroes and is
+* left zeroed; the last slot stands for TABLE_REJECT.
+*/
+static size_t _tableRowDefault(const uint32_t *row, size_t classesCount, size_t statesCount, uint32_t *counts, uint32_t *defaultTarget) {
+    uint32_t best = TABLE_REJECT;
+    uint32_t bestCount = 0;
+
+    for (size_t i = 0; i < classesCount; i++) {
+        size_t slot = row[i] == TABLE_REJECT ? statesCount : row[i];
+
+        if (++counts[slot] > bestCount) {
+            bestCount = counts[slot];
+            best = row[i];
+        }
+    }
+
+    for (size_t i = 0; i < classesCount; i++) {
+        counts[row[i] == TABLE_REJECT ? statesCount : row[i]] = 0;
+    }
+
+    *defaultTarget = best;
+    return classesCount - bestCount;
+}
+
+static int _tableBuildCsr(Table *table, const uint32_t *dense) {
+    size_t statesCount = table->statesCount;
+    size_t classesCount = table->classesCount;
+    uint32_t *counts = calloc(statesCount + 1, sizeof(uint32_t));
+    size_t entries = 0;
+
+    table->rowDefault = malloc((statesCount + 1) * sizeof(uint32_t));
+    table->rowStart = malloc((statesCount + 1) * sizeof(uint32_t));
+
+    if (!counts || !table->rowDefault || !table->rowStart) {
+        free(counts);
+        return 1;
+    }
+
+    uint32_t *rowDefault = table->rowDefault;
+    for (size_t i = 0; i < statesCount; i++) {
+        table->rowStart[i] = entries;
+        entries += _tableRowDefault(dense + i * classesCount, classesCount, statesCount, counts, &rowDefault[i]);
+    }
+    table->rowStart[statesCount] = entries;
+    free(counts);
+
+    table->columns = malloc(entries + 1);
+    uint32_t *targets = malloc((entries + 1) * sizeof(uint32_t));
+
+    if (!table->columns || !targets) {
+        free(targets);
+        return 1;
+    }
+
+    for (size_t i = 0, k = 0; i < statesCount; i++) {
+        const uint32_t *row = dense + i * classesCount;
+
+        for (size_t j = 0; j < classesCount; j++) {
+            if (row[j] != rowDefault[i]) {
+                table->columns[k] = j;
+                targets[k] = row[j];
+                k++;
+            }
+        }
+    }
+
+    table->rowDefault = _tableNarrow(rowDefault, statesCount, table->cellSize);
+    table->targets = _tableNarrow(targets, entries, table->cellSize);
+
+    if (!table->rowDefault || !table->targets) {
+        return 1;
+    }
+
+    table->entriesCount = entries;
+    table->memory += statesCount * table->cellSize + (statesCount + 1) * sizeof(uint32_t);
+    table->memory += entries * (1 + table->cellSize);
+    return 0;
+}
+
+/*
+* Converts row numbers to cellSize bytes, taking ownership of values.
+*/
+static void *_tableNarrow(uint32_t *values, size_t count, size_t cellSize) {
+    if (cellSize == sizeof(uint32_t)) {
+        return values;
+    }
+
+    void *narrow = malloc((count + 1) * cellSize);
+    if (!narrow) {
+        free(values);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (cellSize == sizeof(uint8_t)) {
+            ((uint8_t *)narrow)[i] = values[i] == TABLE_REJECT ? UINT8_MAX : values[i];
+        } else {
+            ((uint16_t *)narrow)[i] = values[i] == TABLE_REJECT ? UINT16_MAX : values[i];
+        }
+    }
+
+    free(values);
+    return narrow;
+}
+
+static uint32_t _tableCell(const void *cells, size_t cellSize, size_t index) {
+    if (cellSize == sizeof(uint8_t)) {
+        uint8_t cell = ((const uint8_t *)cells)[index];
+        return cell == UINT8_MAX ? TABLE_REJECT : cell;
+    } else if (cellSize == sizeof(uint16_t)) {
+        uint16_t cell = ((const uint16_t *)cells)[index];
+        return cell == UINT16_MAX ? TABLE_REJECT : cell;
+    }
+
+    return ((const uint32_t *)cells)[index];
+}
+
+static uint32_t _tableStep(Table *table, uint32_t state, short cls) {
+    if (table->layout == FSM_LAYOUT_DENSE) {
+        return _tableCell(table->cells, table->cellSize, state * table->classesCount + cls);
+    }
+
+    /* Exceptions are sorted by column, so stop as soon as we pass it */
+    for (uint32_t k = table->rowStart[state]; k < table->rowStart[state + 1]; k++) {
+        if (table->columns[k] == cls) {
+            return _tableCell(table->targets, table->cellSize, k);
+        } else if (table->columns[k] > cls) {
+            break;
+        }
+    }
+
+    return _tableCell(table->rowDefault, table->cellSize, state);
+}
+
+/*
+* Finds the rows that loop back to themselves on most of the alphabet and
+* records, for each, the bytes that leave it: bytes outside the alphabet,
+* and symbols going elsewhere. While the matcher sits in such a row it
+* can search ahead for the next of those bytes instead of stepping. The
+* arrays are left NULL when no row qualifies.
+*/
+static int _tableBuildAccel(Table *table) {
+    SimdByteSet outside, runExits, scanExits;
+    unsigned char symbols[256];
+    uint32_t *next = malloc((table->classesCount + 1) * sizeof(uint32_t));
+
+    if (!next) {
+        return 1;
+    }
+
+    simdByteSetInit(&outside);
+    for (size_t b = 0; b < 256; b++) {
+        if (table->classOf[b] < 0) {
+            simdByteSetAdd(&outside, b);
+        } else {
+            symbols[table->classOf[b]] = b;
+        }
+    }
+
+    for (size_t state = 0; state < table->statesCount; state++) {
+        size_t loops = 0;
+
+        for (size_t c = 0; c < table->classesCount; c++) {
+            next[c] = _tableStep(table, state, c);
+            loops += next[c] == state;
+        }
+
+        if (loops == 0 || loops * TABLE_ACCEL_MIN_SHARE < table->classesCount) {
+            continue;
+        }
+
+        /* Scanning restarts on bytes without transition */
+        runExits = outside;
+        if (table->start != state) {
+            scanExits = outside;
+        } else {
+            simdByteSetInit(&scanExits);
+        }
+
+        for (size_t c = 0; c < table->classesCount; c++) {
+            if (next[c] != state) {
+                simdByteSetAdd(&runExits, symbols[c]);
+            }
+            if ((next[c] == TABLE_REJECT ? table->start : next[c]) != state) {
+                simdByteSetAdd(&scanExits, symbols[c]);
+            }
+        }
+
+        int32_t runSet = _tableAddAccelSet(table, &runExits);
+        int32_t scanSet = _tableAddAccelSet(table, &scanExits);
+
+        if (runSet < 0 || scanSet < 0) {
+            free(next);
+            return 1;
+        }
+
+        if (!table->runAccel) {
+            table->runAccel = malloc((table->statesCount + 1) * sizeof(int32_t));
+            table->scanAccel = malloc((table->statesCount + 1) * sizeof(int32_t));
+
+            if (!table->runAccel || !table->scanAccel) {
+                free(next);
+                return 1;
+            }
+
+            for (size_t i = 0; i < table->statesCount; i++) {
+                table->runAccel[i] = -1;
+                table->scanAccel[i] = -1;
+            }
+            table->memory += 2 * table->statesCount * sizeof(int32_t);
+        }
+
+        table->runAccel[state] = runSet;
+
+        /* An accepting row reports a match on every byte, it cannot skip */
+        if (!table->accept[state]) {
+            table->scanAccel[state] = scanSet;
+        }
+    }
+
+    free(next);
+    return 0;
+}
+
+static int32_t _tableAddAccelSet(Table *table, const SimdByteSet *set) {
+    if ((table->accelSetsCount & (table->accelSetsCount - 1)) == 0) {
+        size_t capacity = table->accelSetsCount ? table->accelSetsCount * 2 : 1;
+        SimdByteSet *grown = realloc(table->accelSets, capacity * sizeof(SimdByteSet));
+
+        if (!grown) {
+            return -1;
+        }
+        table->accelSets = grown;
+    }
+
+    table->accelSets[table->accelSetsCount] = *set;
+    table->memory += sizeof(SimdByteSet);
+    return table->accelSetsCount++;
+}
@@ -0,0 +1,93 @@
+#ifndef _TABLE_H_
+#define _TABLE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "fsm.h"
+
+#define TABLE_REJECT UINT32_MAX
+
+typedef struct STransition {
+    int from;
+    char c;
+    int to;
+} Transition;
+
+/*
+* Everything the compiler needs from the builder. States are referenced
+* by their index in the builder, symbols by their byte value. order, when
+* set, lists the builder states in the row order the table should use.
+*/
+typedef struct STableSource {
+    size_t statesCount;
+    const char *alphabet;
+    size_t alphabetCount;
+    const Transition *transitions;
+    size_t transitionsCount;
+    int startState;
+    const char *acceptStates;
+    const uint32_t *order;
+} TableSource;
+
+/*
+* Minimal DFA accepting what a source accepts, without unreachable or
+* dead states, numbered breadth-first from the start state and with its
+* alphabet sorted and cut down to the symbols still used. Two sources
+* accept the same strings exactly when their canonical forms are equal.
+* stateOf gives the canonical state of every source state, TABLE_REJECT
+* for the ones dropped.
+*/
+typedef struct STableCanonical {
+    TableSource source;
+    char alphabet[256];
+    Transition *transitions;
+    char *acceptStates;
+    uint32_t *stateOf;
+    uint64_t hash;
+} TableCanonical;
+
+typedef struct STable Table;
+Table *tableCompile(const TableSource *source, FsmLayout layout);
+void tableDestroy(Table **table);
+int tableCheck(Table *table, const char *input, size_t len);
+uint32_t tableRun(Table *table, uint32_t state, const char *input, size_t len, size_t *consumed);
+uint32_t tableStart(Table *table);
+int tableAccepts(Table *table, uint32_t state);
+int tableCheckStats(Table *table, const char *input, size_t len, FsmStats *stats, const uint32_t *visitOf);
+int tableEquals(Table *table, const TableSource *source);
+void tableGetInfo(Table *table, FsmTableInfo *info);
+
+Table *tableCompileUnanchored(Table *table, size_t maxStates);
+int tableScan(Table *table, uint32_t *state, const char *input, size_t len, size_t offset, FsmMatchCallback callback, void *context);
+
+typedef struct STableSet TableSet;
+TableSet *tableSetCreate(Table *table);
+void tableSetDestroy(TableSet **set);
+void tableSetClear(TableSet *set);
+int tableScanSet(Table *table, TableSet *set, const char *input, size_t len, size_t offset, FsmMatchCallback callback, void *context);
+
+uint32_t *tableOrderBfs(const TableSource *source);
+
+int tableCanonicalize(const TableSource *source, TableCanonical *canonical);
+void tableCanonicalDestroy(TableCanonical *canonical);
+
+typedef struct SFsmPoolEntry FsmPoolEntry;
+void fsmPoolReleaseEntry(FsmPool *pool, FsmPoolEntry *entry);
+FsmCompiled *fsmCompiledCreateShared(Fsm *fsm, FsmPool *pool, FsmPoolEntry *entry, Table *table, const uint32_t *stateOf);
+uint64_t fsmCompiledGetId(const FsmCompiled *compiled);
+
+Table *fsmGetTable(Fsm *fsm);
+Table *fsmCompileTable(Fsm *fsm);
+void fsmGetTableSource(Fsm *fsm, TableSource *source, FsmLayout *layout);
+int fsmHasChoices(Fsm *fsm);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _TABLE_H_
@@ -1,17 +1,24 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "lexer.h"
+#include "../simd/simd.h"
 
+/*
+* Line and column are not tracked while lexing, tokens only carry their
+* offset. lexerLocate resolves it, counting newlines forward from the last
+* located offset so diagnostics in input order stay linear overall.
+*/
 struct SLexer {
     const char *input;
     size_t inputLength;
     size_t position;
-    size_t readPosition;
-    int line;
-    int column;
     char ch;
+    size_t locatedOffset;
+    size_t locatedLineStart;
+    int locatedLine;
 };
 
 /* ORDER RESERVED */
@@ -21,30 +28,49 @@ static const char *const TokenTypeLiterals [] = {
 };
 
 static void _lexerReadChar(Lexer *lexer);
+static void _lexerSkipTo(Lexer *lexer, const SimdByteSet *stop);
 static void _lexerSkipWhitespace(Lexer *lexer);
 static const char *_lexerReadIdent(Lexer *lexer, size_t *len);
+static Token *_lexerToken(TokenType type, char *literal, size_t offset, size_t size);
+static void _lexerInitSets(void);
 
 static int _isLetter(char ch);
 static int _isNumber(char ch);
+static int _isWhitespace(char ch);
+
+/*
+* Bytes ending a whitespace run and an identifier, built once on first
+* use by whichever thread gets there first.
+*/
+static SimdByteSet _notWhitespace;
+static SimdByteSet _notIdent;
+static pthread_once_t _setsOnce = PTHREAD_ONCE_INIT;
 
 /*****************************************************************************
 *                              PUBLIC FUNCTIONS                              *
 ******************************************************************************/
 
 Lexer *lexerCreate(const char *input) {
+    return lexerCreateWithLength(input, strlen(input));
+}
+
+/*
+* Lexes the first inputLength bytes of input, saving the strlen when the
+* caller already knows the length.
+*/
+Lexer *lexerCreateWithLength(const char *input, size_t inputLength) {
     size_t len = sizeof(Lexer);
 
     Lexer *lexer = malloc(len);
     memset(lexer, 0, len);
 
+    pthread_once(&_setsOnce, _lexerInitSets);
+
     lexer->input = input;
-    lexer->inputLength = strlen(input);
+    lexer->inputLength = inputLength;
     lexer->position = 0;
-    lexer->readPosition = 0;
-    lexer->line = 1;
-    lexer->column = 0;
-
-    _lexerReadChar(lexer);
+    lexer->ch = inputLength > 0 ? input[0] : '\0';
+    lexer->locatedLine = 1;
 
     return lexer;
 }
@@ -59,36 +85,38 @@ void lexerDestroy(Lexer **lexer) {
 
 Token *lexerNext(Lexer *lexer) {
     Token *tok = NULL;
+    size_t offset;
 
     _lexerSkipWhitespace(lexer);
+    offset = lexer->position;
 
     switch (lexer->ch) {
         case '(':
-            tok = tokenCreate(TK_LPAREN, NULL, lexer->line, lexer->column, 1);
+            tok = _lexerToken(TK_LPAREN, NULL, offset, 1);
             break;
         case ')':
-            tok = tokenCreate(TK_RPAREN, NULL, lexer->line, lexer->column, 1);
+            tok = _lexerToken(TK_RPAREN, NULL, offset, 1);
             break;
         case '{':
-            tok = tokenCreate(TK_LSQUIRLY, NULL, lexer->line, lexer->column, 1);
+            tok = _lexerToken(TK_LSQUIRLY, NULL, offset, 1);
             break;
         case '}':
-            tok = tokenCreate(TK_RSQUIRLY, NULL, lexer->line, lexer->column, 1);
+            tok = _lexerToken(TK_RSQUIRLY, NULL, offset, 1);
             break;
         case ',':
-            tok = tokenCreate(TK_COMMA, NULL, lexer->line, lexer->column, 1);
+            tok = _lexerToken(TK_COMMA, NULL, offset, 1);
             break;
         case ';':
-            tok = tokenCreate(TK_SEMICOLON, NULL, lexer->line, lexer->column, 1);
+            tok = _lexerToken(TK_SEMICOLON, NULL, offset, 1);
             break;
         case '|':
-            tok = tokenCreate(TK_PIPE, NULL, lexer->line, lexer->column, 1);
+            tok = _lexerToken(TK_PIPE, NULL, offset, 1);
             break;
         case '=':
-            tok = tokenCreate(TK_ASSIGN, NULL, lexer->line, lexer->column, 1);
+            tok = _lexerToken(TK_ASSIGN, NULL, offset, 1);
             break;
         case '\0':
-            tok = tokenCreate(TK_EOF, NULL, lexer->line, lexer->column, 1);
+            tok = _lexerToken(TK_EOF, NULL, offset, 1);
             break;
     }
 
@@ -99,12 +127,12 @@ Token *lexerNext(Lexer *lexer) {
 
         literal = strndup(ident, len);
 
-        tok = tokenCreate(TK_IDENT, literal, lexer->line, lexer->column - len, len);
+        tok = _lexerToken(TK_IDENT, literal, offset, len);
         return tok;
     }
 
     if (!tok) {
-        tok = tokenCreate(TK_ILLEGAL, NULL, lexer->line, lexer->column, 1);
+        tok = _lexerToken(TK_ILLEGAL, NULL, offset, 1);
     }
 
     _lexerReadChar(lexer);
@@ -116,6 +144,37 @@ const char *lexerGetInput(Lexer *lexer) {
     return lexer->input;
 }
 
+size_t lexerGetInputLength(Lexer *lexer) {
+    return lexer->inputLength;
+}
+
+/*
+* Fills in the 1-based line and column of the token from its offset.
+*/
+void lexerLocate(Lexer *lexer, Token *token) {
+    size_t offset = token->offset < lexer->inputLength ? token->offset : lexer->inputLength;
+
+    if (offset < lexer->locatedOffset) {
+        lexer->locatedOffset = 0;
+        lexer->locatedLineStart = 0;
+        lexer->locatedLine = 1;
+    }
+
+    const char *cursor = lexer->input + lexer->locatedOffset;
+    const char *end = lexer->input + offset;
+    const char *newline;
+
+    while (cursor < end && (newline = memchr(cursor, '\n', end - cursor))) {
+        lexer->locatedLine++;
+        lexer->locatedLineStart = newline + 1 - lexer->input;
+        cursor = newline + 1;
+    }
+    lexer->locatedOffset = offset;
+
+    token->line = lexer->locatedLine;
+    token->column = (int)(token->offset - lexer->locatedLineStart) + 1;
+}
+
 const char *tokenTypeToLiteral(TokenType type) {
     return TokenTypeLiterals[type];
 }
@@ -152,26 +211,51 @@ void tokenDestroy(Token **token) {
 ******************************************************************************/
 
 static void _lexerReadChar(Lexer *lexer) {
-    if (lexer->readPosition >= lexer->inputLength) {
-        lexer->ch = '\0';
-    } else {
-        lexer->ch = lexer->input[lexer->readPosition];
+    if (lexer->position < lexer->inputLength) {
+        lexer->position++;
     }
 
-    if (lexer->ch == '\n') {
-        lexer->line++;
-        lexer->column = 1;
-    } else {
-        lexer->column++;
-    }
+    lexer->ch = lexer->position < lexer->inputLength ? lexer->input[lexer->position] : '\0';
+}
 
-    lexer->position = lexer->readPosition;
-    lexer->readPosition++;
+/*
+* Moves to the next byte in stop, or to the end of the input.
+*/
+static void _lexerSkipTo(Lexer *lexer, const SimdByteSet *stop) {
+    lexer->position += simdFindInSet(stop, lexer->input + lexer->position, lexer->inputLength - lexer->position);
+    lexer->ch = lexer->position < lexer->inputLength ? lexer->input[lexer->position] : '\0';
 }
 
 static void _lexerSkipWhitespace(Lexer *lexer) {
-    while (lexer->ch == ' ' || lexer->ch == '\t' || lexer->ch == '\n' || lexer->ch == '\r') {
-        _lexerReadChar(lexer);
+    /* Most tokens are separated by a single space or none at all */
+    if (!_isWhitespace(lexer->ch)) {
+        return;
+    }
+
+    _lexerReadChar(lexer);
+    if (_isWhitespace(lexer->ch)) {
+        _lexerSkipTo(lexer, &_notWhitespace);
+    }
+}
+
+static Token *_lexerToken(TokenType type, char *literal, size_t offset, size_t size) {
+    Token *token = tokenCreate(type, literal, 0, 0, size);
+    token->offset = offset;
+
+    return token;
+}
+
+static void _lexerInitSets(void) {
+    simdByteSetInit(&_notWhitespace);
+    simdByteSetInit(&_notIdent);
+
+    for (int byte = 0; byte < 256; byte++) {
+        if (!_isWhitespace((char)byte)) {
+            simdByteSetAdd(&_notWhitespace, byte);
+        }
+        if (!_isLetter((char)byte) && !_isNumber((char)byte)) {
+            simdByteSetAdd(&_notIdent, byte);
+        }
     }
 }
 
@@ -183,13 +267,14 @@ static int _isNumber(char ch) {
     return '0' <= ch && '9' >= ch;
 }
 
+static int _isWhitespace(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\n' || ch == '\r';
+}
+
 static const char *_lexerReadIdent(Lexer *lexer, size_t *len) {
-    char *result = NULL;
     size_t position = lexer->position;
 
-    while (_isLetter(lexer->ch) || _isNumber(lexer->ch)) {
-        _lexerReadChar(lexer);
-    }
+    _lexerSkipTo(lexer, &_notIdent);
 
     if (len) {
         *len = lexer->position - position;
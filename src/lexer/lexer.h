@@ -27,19 +27,27 @@ typedef enum {
 
 const char *tokenTypeToLiteral(TokenType type);
 
+/*
+* Tokens returned by lexerNext only have their offset set, line and column
+* stay 0 until lexerLocate fills them in.
+*/
 typedef struct SToken {
     TokenType type;
     char *literal;
     int line;
     int column;
     size_t size;
+    size_t offset;
 } Token;
 
 typedef struct SLexer Lexer;
 Lexer *lexerCreate(const char *input);
+Lexer *lexerCreateWithLength(const char *input, size_t inputLength);
 
 Token *lexerNext(Lexer *lexer);
 const char *lexerGetInput(Lexer *lexer);
+size_t lexerGetInputLength(Lexer *lexer);
+void lexerLocate(Lexer *lexer, Token *token);
 void lexerDestroy(Lexer **lexer);
 
 Token *tokenCreate(TokenType type, char *literal, int line, int column, size_t size);
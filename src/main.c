@@ -1,60 +1,440 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "lexer/lexer.h"
 #include "parser/parser.h"
 #include "fsm/fsm.h"
+#include "server/server.h"
+#include "bulk/bulk.h"
 
-char *readFile(const char *filename);
+#define USAGE "Usage: %s [--stats] [--nfa] [--order definition|bfs] [--profile <file>] [--save-profile <file>] <filename> <test_string>\n" \
+              "       %s --scan <filename> <input_file|->\n" \
+              "       %s [--cache <entries>] --serve <socket> <filename>...\n" \
+              "       %s --bulk <directory|filelist> <filename>\n" \
+              "       %s [--stats] [--cache <entries>] --batch <input_file|-> <filename>\n"
+#define SCAN_CHUNK_SIZE (64 * 1024)
+#define BATCH_READ_SIZE (1024 * 1024)
+
+/*
+* With a cache, lines are checked this many at a time, so that each
+* window is answered from what the ones before left in the cache.
+*/
+#define BATCH_CACHE_WINDOW 4096
+
+void printStats(Fsm *fsm);
+int serve(const char *socketPath, char **definitions, size_t definitionsCount, size_t cacheCapacity);
+int bulk(const char *source, const char *definition);
+int batch(const char *source, const char *definition, int stats, size_t cacheCapacity);
+int scanFile(Fsm *fsm, const char *filename);
+int printMatch(size_t end, void *context);
 
 int main(int argc, char *argv[]) {
-    char *fileContent;
     size_t totalTokens = 0;
+    int stats = 0;
+    int scan = 0;
+    int parseFlags = 0;
+    FsmOrder order = FSM_ORDER_DEFINITION;
+    int orderGiven = 0;
+    char *profileFile = NULL;
+    char *saveProfileFile = NULL;
+    char *socketPath = NULL;
+    char *bulkSource = NULL;
+    char *batchSource = NULL;
+    size_t cacheCapacity = 0;
+    FsmProfile *profile = NULL;
+    int argi = 1;
+
+    for (; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+        char *value = argi + 1 < argc ? argv[argi + 1] : NULL;
+
+        if (strcmp(argv[argi], "--stats") == 0) {
+            stats = 1;
+            continue;
+        } else if (strcmp(argv[argi], "--scan") == 0) {
+            scan = 1;
+            continue;
+        } else if (strcmp(argv[argi], "--nfa") == 0) {
+            parseFlags |= PARSER_NONDETERMINISTIC;
+            continue;
+        } else if (!value) {
+            fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0], argv[0]);
+            return EXIT_FAILURE;
+        }
+
+        if (strcmp(argv[argi], "--order") == 0 && strcmp(value, "definition") == 0) {
+            order = FSM_ORDER_DEFINITION;
+            orderGiven = 1;
+        } else if (strcmp(argv[argi], "--order") == 0 && strcmp(value, "bfs") == 0) {
+            order = FSM_ORDER_BFS;
+            orderGiven = 1;
+        } else if (strcmp(argv[argi], "--profile") == 0) {
+            profileFile = value;
+        } else if (strcmp(argv[argi], "--save-profile") == 0) {
+            saveProfileFile = value;
+        } else if (strcmp(argv[argi], "--serve") == 0) {
+            socketPath = value;
+        } else if (strcmp(argv[argi], "--bulk") == 0) {
+            bulkSource = value;
+        } else if (strcmp(argv[argi], "--batch") == 0) {
+            batchSource = value;
+        } else if (strcmp(argv[argi], "--cache") == 0) {
+            char *end;
+
+            cacheCapacity = strtoul(value, &end, 10);
+            if (*end != '\0' || cacheCapacity == 0) {
+                fprintf(stderr, "Invalid cache size '%s'\n", value);
+                return EXIT_FAILURE;
+            }
+        } else {
+            fprintf(stderr, "Unknown option '%s %s'\n", argv[argi], value);
+            return EXIT_FAILURE;
+        }
+        argi++;
+    }
+
+    if (orderGiven && profileFile) {
+        fprintf(stderr, "Error --order and --profile both set the state order, give only one\n");
+        return EXIT_FAILURE;
+    }
 
-    if (argc < 3) {
-        fprintf(stderr, "Usage: %s <filename> <test_string>\n", argv[0]);
+    if (socketPath && argc - argi >= 1) {
+        return serve(socketPath, &argv[argi], argc - argi, cacheCapacity);
+    } else if (bulkSource && argc - argi == 1) {
+        return bulk(bulkSource, argv[argi]);
+    } else if (batchSource && argc - argi == 1) {
+        return batch(batchSource, argv[argi], stats, cacheCapacity);
+    } else if (argc - argi < 2 || (scan && (stats || saveProfileFile))) {
+        /* The scanner keeps no counters to report */
+        fprintf(stderr, USAGE, argv[0], argv[0], argv[0], argv[0], argv[0]);
         return EXIT_FAILURE;
     }
-    if (!(fileContent = readFile(argv[1]))) {
-        fprintf(stderr, "Error reading file or file is empty");
+    Fsm *fsm = parserParseFileWith(argv[argi], parseFlags);
+    if (!fsm) {
         return EXIT_FAILURE;
     }
 
-    Lexer *lexer = lexerCreate(fileContent);
-    Parser *parser = parserCreate(lexer);
-    Fsm *fsm = parserParse(parser);
+    if (profileFile) {
+        if (!(profile = fsmProfileLoad(profileFile))) {
+            return EXIT_FAILURE;
+        }
+        order = FSM_ORDER_PROFILE;
+    }
+    if (fsmSetStateOrder(fsm, order, profile) != 0) {
+        return EXIT_FAILURE;
+    }
+    if ((stats || saveProfileFile) && fsmEnableStats(fsm, 1) != 0) {
+        return EXIT_FAILURE;
+    }
+    if (fsmCompile(fsm) != 0) {
+        return EXIT_FAILURE;
+    }
 
-    if (fsmCheck(fsm, argv[2]) == 1) {
-        printf("String '%s' is accepted by FSM %s\n", argv[2], fsmGetName(fsm));
+    if (scan) {
+        if (scanFile(fsm, argv[argi + 1]) != 0) {
+            return EXIT_FAILURE;
+        }
+    } else if (fsmCheck(fsm, argv[argi + 1]) == 1) {
+        printf("String '%s' is accepted by FSM %s\n", argv[argi + 1], fsmGetName(fsm));
     } else {
-        printf("String '%s' is NOT accepted by FSM %s\n", argv[2], fsmGetName(fsm));
+        printf("String '%s' is NOT accepted by FSM %s\n", argv[argi + 1], fsmGetName(fsm));
+    }
+
+    if (stats) {
+        printStats(fsm);
+    }
+
+    if (saveProfileFile) {
+        if (!profile && !(profile = fsmProfileCreate())) {
+            return EXIT_FAILURE;
+        }
+        if (fsmProfileAddStats(profile, fsm) != 0 || fsmProfileSave(profile, saveProfileFile) != 0) {
+            return EXIT_FAILURE;
+        }
     }
+    fsmProfileDestroy(&profile);
 
-    lexerDestroy(&lexer);
-    parserDestroy(&parser);
     fsmDestroy(&fsm);
 
     return EXIT_SUCCESS;
 }
 
-char *readFile(const char *filename) {
-    FILE *file;
-    char *buffer;
-    long size;
+/*
+* Loads the definitions once and answers checks on the socket until
+* SIGINT or SIGTERM, SIGHUP reloads them. With a cache, SIGUSR1 and
+* stopping print its counters.
+*/
+int serve(const char *socketPath, char **definitions, size_t definitionsCount, size_t cacheCapacity) {
+    Server *server = serverCreate(socketPath, definitions, definitionsCount);
+    int res;
+
+    if (!server) {
+        return EXIT_FAILURE;
+    }
+    if (cacheCapacity > 0 && serverEnableCache(server, cacheCapacity) != 0) {
+        serverDestroy(&server);
+        return EXIT_FAILURE;
+    }
+
+    res = serverHandleSignals(server) == 0 && serverRun(server) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    serverDestroy(&server);
+
+    return res;
+}
+
+/*
+* Prints how many lines of each file the FSM accepts, as
+* "<accepted> <lines> <file>".
+*/
+int bulk(const char *source, const char *definition) {
+    size_t count;
+    char **files = bulkListFiles(source, &count);
+    Fsm *fsm = parserParseFile(definition);
+    FsmCompiled *compiled = fsm ? fsmCompiledCreate(fsm) : NULL;
+    BulkResult *results = calloc(count + 1, sizeof(BulkResult));
+    long workers = sysconf(_SC_NPROCESSORS_ONLN);
+    int res = EXIT_FAILURE;
 
-    if (!(file = fopen(filename, "r"))) {
-        return NULL;
+    fsmDestroy(&fsm);
+
+    if (files && compiled && results) {
+        res = bulkCheckFiles(compiled, files, count, workers > 1 ? workers - 1 : 1, results) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+
+        for (size_t i = 0; i < count; i++) {
+            if (!results[i].error) {
+                printf("%zu %zu %s\n", results[i].accepted, results[i].lines, files[i]);
+            }
+        }
     }
 
-    fseek(file, 0, SEEK_END);
-    size = ftell(file);
-    fseek(file, 0, SEEK_SET);
+    free(results);
+    fsmCompiledRelease(&compiled);
+    bulkFreeList(&files, count);
+
+    return res;
+}
+
+/*
+* Checks every line of the file ("-" for stdin) at once, sharing the
+* walk of common prefixes, and prints 1 or 0 for each, in order. With a
+* cache, lines seen before are answered from it and only the others are
+* walked. With stats, also prints how many bytes were walked out of the
+* total and the cache counters.
+*/
+int batch(const char *source, const char *definition, int stats, size_t cacheCapacity) {
+    Fsm *fsm = parserParseFile(definition);
+    FsmCompiled *compiled = fsm ? fsmCompiledCreate(fsm) : NULL;
+    FsmCache *cache = cacheCapacity > 0 ? fsmCacheCreate(cacheCapacity) : NULL;
+    int fd = strcmp(source, "-") == 0 ? STDIN_FILENO : open(source, O_RDONLY);
+    size_t len = 0, capacity = BATCH_READ_SIZE;
+    char *content = malloc(capacity);
+    ssize_t got = 0;
+    int res = EXIT_FAILURE;
 
-    buffer = malloc(size + 1);
-    fread(buffer, 1, size, file);
-    buffer[size] = '\0';
+    fsmDestroy(&fsm);
 
-    fclose(file);
+    if (fd < 0) {
+        fprintf(stderr, "Error reading file '%s'\n", source);
+    }
 
-    return buffer;
+    while (fd >= 0 && content && (got = read(fd, content + len, capacity - len)) > 0) {
+        len += got;
+        if (len == capacity) {
+            char *grown = realloc(content, capacity * 2);
+
+            if (!grown) {
+                free(content);
+                content = NULL;
+                break;
+            }
+            content = grown;
+            capacity *= 2;
+        }
+    }
+
+    if (fd >= 0 && fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    if (fd >= 0 && got == 0 && content && compiled && (cache || !cacheCapacity)) {
+        size_t count = 0;
+
+        for (size_t i = 0; i < len; i++) {
+            count += content[i] == '\n';
+        }
+        count += len > 0 && content[len - 1] != '\n';
+
+        const char **inputs = malloc((count + 1) * sizeof(char *));
+        size_t *lens = malloc((count + 1) * sizeof(size_t));
+        int *results = malloc((count + 1) * sizeof(int));
+        int *checked = malloc((count + 1) * sizeof(int));
+        size_t *missed = malloc((count + 1) * sizeof(size_t));
+        size_t walked, bytes = 0;
+
+        if (inputs && lens && results && checked && missed) {
+            size_t window = cache ? BATCH_CACHE_WINDOW : count;
+            char *line = content;
+            int failed = 0;
+
+            walked = 0;
+
+            for (size_t first = 0; first < count; first += window) {
+                size_t last = count - first < window ? count : first + window;
+                size_t missedCount = 0, windowWalked;
+
+                /* Lines the cache misses are moved to the front, in order */
+                for (size_t i = first; i < last; i++) {
+                    char *end = memchr(line, '\n', content + len - line);
+                    size_t lineLen = end ? (size_t)(end - line) : (size_t)(content + len - line);
+
+                    results[i] = cache ? fsmCacheLookup(cache, compiled, line, lineLen) : -1;
+                    if (results[i] < 0) {
+                        inputs[missedCount] = line;
+                        lens[missedCount] = lineLen;
+                        missed[missedCount++] = i;
+                    }
+                    line += lineLen + 1;
+                    bytes += lineLen;
+                }
+
+                if (fsmCompiledCheckBatch(compiled, inputs, lens, missedCount, checked, &windowWalked) != 0) {
+                    failed = 1;
+                    break;
+                }
+                walked += windowWalked;
+
+                for (size_t i = 0; i < missedCount; i++) {
+                    results[missed[i]] = checked[i];
+                    if (cache) {
+                        fsmCacheInsert(cache, compiled, inputs[i], lens[i], checked[i]);
+                    }
+                }
+            }
+
+            if (!failed) {
+                for (size_t i = 0; i < count; i++) {
+                    printf("%d\n", results[i]);
+                }
+                if (stats) {
+                    printf("{\"inputs\":%zu,\"bytes\":%zu,\"walked\":%zu", count, bytes, walked);
+                    if (cache) {
+                        FsmCacheStats cacheStats;
+
+                        fsmCacheGetStats(cache, &cacheStats);
+                        printf(",\"cache\":{\"hits\":%zu,\"misses\":%zu,\"bypassed\":%zu,\"evictions\":%zu,\"entries\":%zu,\"capacity\":%zu}",
+                            cacheStats.hits, cacheStats.misses, cacheStats.bypassed, cacheStats.evictions, cacheStats.entries, cacheStats.capacity);
+                    }
+                    printf("}\n");
+                }
+                res = EXIT_SUCCESS;
+            }
+        } else {
+            fprintf(stderr, "Error allocating memory\n");
+        }
+
+        free(inputs);
+        free(lens);
+        free(results);
+        free(checked);
+        free(missed);
+    } else if (!content) {
+        fprintf(stderr, "Error allocating memory\n");
+    } else if (got < 0) {
+        fprintf(stderr, "Error reading file '%s'\n", source);
+    }
+
+    free(content);
+    fsmCacheDestroy(&cache);
+    fsmCompiledRelease(&compiled);
+    return res;
+}
+
+/*
+* Prints the end offset of every match in the file, one per line. Files
+* are mapped and scanned in place, "-" streams stdin in chunks.
+*/
+int scanFile(Fsm *fsm, const char *filename) {
+    FsmScanner *scanner = fsmScannerCreate(fsm);
+    int res = 0;
+
+    if (!scanner) {
+        return 1;
+    }
+
+    if (strcmp(filename, "-") == 0) {
+        char *chunk = malloc(SCAN_CHUNK_SIZE);
+        ssize_t len;
+
+        if (!chunk) {
+            fprintf(stderr, "Error allocating memory\n");
+            fsmScannerDestroy(&scanner);
+            return 1;
+        }
+
+        while ((len = read(STDIN_FILENO, chunk, SCAN_CHUNK_SIZE)) > 0) {
+            fsmScannerFeed(scanner, chunk, len, printMatch, NULL);
+        }
+
+        res = len < 0;
+        free(chunk);
+    } else {
+        struct stat st;
+        int fd = open(filename, O_RDONLY);
+
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            fprintf(stderr, "Error reading file '%s'\n", filename);
+            res = 1;
+        } else if (st.st_size > 0) {
+            char *input = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+            if (input == MAP_FAILED) {
+                fprintf(stderr, "Error mapping file '%s'\n", filename);
+                res = 1;
+            } else {
+                madvise(input, st.st_size, MADV_SEQUENTIAL);
+                fsmScannerFeed(scanner, input, st.st_size, printMatch, NULL);
+                munmap(input, st.st_size);
+            }
+        }
+
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    fsmScannerDestroy(&scanner);
+    return res;
+}
+
+int printMatch(size_t end, void *context) {
+    (void)context;
+    printf("%zu\n", end);
+    return 0;
+}
+
+void printStats(Fsm *fsm) {
+    static const char *const layouts[] = { "auto", "dense", "csr" };
+    static const char *const engines[] = { "table", "bitparallel" };
+    FsmStats stats;
+    FsmTableInfo info;
+
+    if (fsmGetStats(fsm, &stats) != 0 || fsmGetTableInfo(fsm, &info) != 0) {
+        return;
+    }
+
+    printf("{\"fsm\":\"%s\",", fsmGetName(fsm));
+    printf("\"table\":{\"engine\":\"%s\",\"layout\":\"%s\",\"cellSize\":%zu,\"states\":%zu,\"classes\":%zu,\"entries\":%zu,\"accelerated\":%zu,\"memory\":%zu},",
+        engines[info.engine], layouts[info.layout], info.cellSize, info.states, info.classes, info.entries, info.accelerated, info.memory);
+    printf("\"bytesProcessed\":%zu,\"inputsChecked\":%zu,\"accepts\":%zu,", stats.bytesProcessed, stats.inputsChecked, stats.accepts);
+    printf("\"rejects\":{\"badSymbol\":%zu,\"noTransition\":%zu,\"notAccepting\":%zu},",
+        stats.rejectsBadSymbol, stats.rejectsNoTransition, stats.rejectsNotAccepting);
+    printf("\"stateVisits\":{");
+    for (size_t i = 0; i < stats.statesCount; i++) {
+        printf("%s\"%s\":%zu", i ? "," : "", fsmGetStateName(fsm, i), stats.stateVisits[i]);
+    }
+    printf("}}\n");
 }
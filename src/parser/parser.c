@@ -1,24 +1,45 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <setjmp.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "parser.h"
 #include "../lexer/lexer.h"
 #include "../fsm/fsm.h"
 
+#define PARSER_MAX_HELD 3
+
+/*
+* Errors exit the process, unless parsing from parserTryParse which jumps
+* back to recover instead. fsm is what has been built so far, held the
+* literals being handled, freed on failure.
+*/
 struct SParser {
     Lexer *lexer;
     Token *currentToken;
+    Fsm *fsm;
+    char *held[PARSER_MAX_HELD];
+    size_t heldCount;
+    int flags;
+    int recoverable;
+    jmp_buf recover;
 };
 
+void _parserFail(Parser *parser);
+void _parserHold(Parser *parser, char *literal);
+void _parserFreeHeld(Parser *parser);
 Token _consume(Parser *parser, TokenType type);
 int _consumeOptional(Parser *parser, TokenType type);
-void _parseStates(Parser *parser, Fsm *fsm, int (*stateHelper)(Fsm *, char *));
+void _parseStates(Parser *parser, Fsm *fsm, int (*stateHelper)(Fsm *, char *), int keepsName);
 void _parseAlphabet(Parser *parser, Fsm *fsm);
 void _parseTransitions(Parser *parser, Fsm *fsm);
-void _validateTokenSizeIsOne(Token token, const char *input);
-void _printInputLocation(int line, int col, size_t size, const char *input);
-void _printInputLocationFromToken(Token token, const char *input);
+void _validateTokenSizeIsOne(Parser *parser, Token token);
+void _printInputLocation(Parser *parser, Token token, size_t size);
+void _printInputLocationFromToken(Parser *parser, Token token);
 
 /*****************************************************************************
 *                              PUBLIC FUNCTIONS                              *
@@ -36,35 +57,116 @@ Parser *parserCreate(Lexer *lexer) {
 Fsm *parserParse(Parser *parser) {
     Token name = _consume(parser, TK_IDENT);
     Fsm *fsm = fsmCreate(name.literal);
+    parser->fsm = fsm;
+
+    if (parser->flags & PARSER_NONDETERMINISTIC) {
+        fsmSetNondeterministic(fsm, 1);
+    }
 
     _consume(parser, TK_ASSIGN);
 
     int consumed = _consumeOptional(parser, TK_LPAREN);
 
-    _parseStates(parser, fsm, fsmAddState);
+    _parseStates(parser, fsm, fsmAddState, 1);
     _consume(parser, TK_SEMICOLON);
     _parseAlphabet(parser, fsm);
     _consume(parser, TK_SEMICOLON);
     _parseTransitions(parser, fsm);
-    fsmValidateTransitions(fsm);
+
+    FsmValidation validation;
+    if (fsmValidateTransitions(fsm, &validation) != 0) {
+        fsmValidationPrint(&validation);
+        fsmValidationDestroy(&validation);
+        _parserFail(parser);
+    }
+    fsmValidationDestroy(&validation);
+
     _consume(parser, TK_SEMICOLON);
 
     Token start = _consume(parser, TK_IDENT);
+    _parserHold(parser, start.literal);
     if (fsmAddStartState(fsm, start.literal) != 0) {
-        _printInputLocationFromToken(start, lexerGetInput(parser->lexer));
-        exit(EXIT_FAILURE);
+        _printInputLocationFromToken(parser, start);
+        _parserFail(parser);
     }
+    _parserFreeHeld(parser);
 
     _consume(parser, TK_SEMICOLON);
-    _parseStates(parser, fsm, fsmAddAcceptState);
+    _parseStates(parser, fsm, fsmAddAcceptState, 0);
 
     if (consumed == 1) {
         _consume(parser, TK_RPAREN);
     }
 
+    parser->fsm = NULL;
+    return fsm;
+}
+
+/*
+* Same as parserParse, but errors return NULL instead of exiting.
+*/
+Fsm *parserTryParse(Parser *parser) {
+    if (setjmp(parser->recover) != 0) {
+        parser->recoverable = 0;
+        fsmDestroy(&parser->fsm);
+        return NULL;
+    }
+
+    parser->recoverable = 1;
+    Fsm *fsm = parserParse(parser);
+    parser->recoverable = 0;
+
+    return fsm;
+}
+
+Fsm *parserParseFile(const char *filename) {
+    return parserParseFileWith(filename, 0);
+}
+
+/*
+* Maps the definition read-only and parses it in place, no copy or NUL
+* terminator needed. Errors are printed and return NULL.
+*/
+Fsm *parserParseFileWith(const char *filename, int flags) {
+    struct stat st;
+    Fsm *fsm = NULL;
+    int fd = open(filename, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        fprintf(stderr, "Error reading file '%s' or file is empty\n", filename);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    char *content = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (content == MAP_FAILED) {
+        fprintf(stderr, "Error mapping file '%s'\n", filename);
+        return NULL;
+    }
+    madvise(content, st.st_size, MADV_SEQUENTIAL);
+
+    /* The FSM copies what it keeps, the mapping is released right away */
+    Lexer *lexer = lexerCreateWithLength(content, st.st_size);
+    Parser *parser = parserCreate(lexer);
+
+    parserSetFlags(parser, flags);
+    fsm = parserTryParse(parser);
+
+    parserDestroy(&parser);
+    lexerDestroy(&lexer);
+    munmap(content, st.st_size);
+
     return fsm;
 }
 
+void parserSetFlags(Parser *parser, int flags) {
+    parser->flags = flags;
+}
+
 void parserDestroy(Parser **parser) {
     if (*parser && (*parser)->currentToken) {
         tokenDestroy(&(*parser)->currentToken);
@@ -81,9 +183,37 @@ void parserDestroy(Parser **parser) {
 *                              PRIVATE FUNCTIONS                             *
 ******************************************************************************/
 
+void _parserFail(Parser *parser) {
+    _parserFreeHeld(parser);
+
+    if (parser->recoverable) {
+        longjmp(parser->recover, 1);
+    }
+
+    exit(EXIT_FAILURE);
+}
+
+/*
+* Keeps a literal to free should parsing fail before it is handled.
+*/
+void _parserHold(Parser *parser, char *literal) {
+    parser->held[parser->heldCount++] = literal;
+}
+
+void _parserFreeHeld(Parser *parser) {
+    for (size_t i = 0; i < parser->heldCount; i++) {
+        free(parser->held[i]);
+    }
+
+    parser->heldCount = 0;
+}
+
 Token _getToken(Parser *parser) {
     if (parser->currentToken == NULL) {
-        return *lexerNext(parser->lexer);
+        Token *next = lexerNext(parser->lexer);
+        Token token = *next;
+        free(next);
+        return token;
     } else {
         Token token = *parser->currentToken;
         free(parser->currentToken);
@@ -96,8 +226,9 @@ Token _consume(Parser *parser, TokenType type) {
     Token token = _getToken(parser);
     if (token.type != type) {
         fprintf(stderr, "Expected token type '%s', got '%s'\n", tokenTypeToLiteral(type), tokenTypeToLiteral(token.type));
-        _printInputLocationFromToken(token, lexerGetInput(parser->lexer));
-        exit(EXIT_FAILURE);
+        _printInputLocationFromToken(parser, token);
+        free(token.literal);
+        _parserFail(parser);
     }
     return token;
 }
@@ -111,7 +242,8 @@ int _consumeOptional(Parser *parser, TokenType type) {
     Token *tok;
     if (!(tok = (Token *)malloc(sizeof(Token)))) {
         fprintf(stderr, "Error allocating memory\n");
-        exit(EXIT_FAILURE);
+        free(token.literal);
+        _parserFail(parser);
     }
     (*tok) = token;
     parser->currentToken = tok;
@@ -119,14 +251,24 @@ int _consumeOptional(Parser *parser, TokenType type) {
     return 0;
 }
 
-void _parseStates(Parser *parser, Fsm *fsm, int (*stateHandler)(Fsm *, char *)) {
+/*
+* keepsName tells whether the handler takes ownership of the state name,
+* otherwise the literal is freed once handled.
+*/
+void _parseStates(Parser *parser, Fsm *fsm, int (*stateHandler)(Fsm *, char *), int keepsName) {
     int consumed = _consumeOptional(parser, TK_LSQUIRLY);
 
     do {
         Token tok = _consume(parser, TK_IDENT);
+        _parserHold(parser, tok.literal);
         if (stateHandler(fsm, tok.literal) != 0) {
-            _printInputLocationFromToken(tok, lexerGetInput(parser->lexer));
-            exit(EXIT_FAILURE);
+            _printInputLocationFromToken(parser, tok);
+            _parserFail(parser);
+        }
+        if (keepsName) {
+            parser->heldCount = 0;
+        } else {
+            _parserFreeHeld(parser);
         }
     } while (_consumeOptional(parser, TK_COMMA));
 
@@ -140,12 +282,14 @@ void _parseAlphabet(Parser *parser, Fsm *fsm) {
 
     do {
         Token tok = _consume(parser, TK_IDENT);
-        _validateTokenSizeIsOne(tok, lexerGetInput(parser->lexer));
+        _parserHold(parser, tok.literal);
+        _validateTokenSizeIsOne(parser, tok);
 
         if (fsmAddToAlphabet(fsm, tok.literal[0]) != 0) {
-            _printInputLocationFromToken(tok, lexerGetInput(parser->lexer));
-            exit(EXIT_FAILURE);
+            _printInputLocationFromToken(parser, tok);
+            _parserFail(parser);
         }
+        _parserFreeHeld(parser);
     } while (_consumeOptional(parser, TK_COMMA));
 
     if (consumed == 1) {
@@ -158,27 +302,33 @@ void _parseTransitions(Parser *parser, Fsm *fsm) {
 
     do {
         Token from = _consume(parser, TK_IDENT);
+        _parserHold(parser, from.literal);
         _consume(parser, TK_COMMA);
         Token c = _consume(parser, TK_IDENT);
+        _parserHold(parser, c.literal);
         _consume(parser, TK_COMMA);
         Token to = _consume(parser, TK_IDENT);
+        _parserHold(parser, to.literal);
 
         int res = fsmAddTransition(fsm, from.literal, c.literal[0], to.literal);
 
         if (res == 2) {
-            _printInputLocationFromToken(from, lexerGetInput(parser->lexer));
-            exit(EXIT_FAILURE);
+            _printInputLocationFromToken(parser, from);
+            _parserFail(parser);
         } else if (res == 3) {
-            _printInputLocationFromToken(c, lexerGetInput(parser->lexer));
-            exit(EXIT_FAILURE);
+            _printInputLocationFromToken(parser, c);
+            _parserFail(parser);
         } else if (res == 4) {
-            _printInputLocationFromToken(to, lexerGetInput(parser->lexer));
-            exit(EXIT_FAILURE);
+            _printInputLocationFromToken(parser, to);
+            _parserFail(parser);
         } else if (res != 0) {
-            _printInputLocation(from.line, from.column, from.size + c.size + to.size + 2, lexerGetInput(parser->lexer));
-            exit(EXIT_FAILURE);
+            _printInputLocation(parser, from, to.offset + to.size - from.offset);
+            _parserFail(parser);
         }
 
+        /* Transitions store state indices, the names are not kept */
+        _parserFreeHeld(parser);
+
     } while (_consumeOptional(parser, TK_PIPE));
 
     if (consumed == 1) {
@@ -186,52 +336,42 @@ void _parseTransitions(Parser *parser, Fsm *fsm) {
     }
 }
 
-void _validateTokenSizeIsOne(Token token, const char *input) {
+void _validateTokenSizeIsOne(Parser *parser, Token token) {
     if (token.size > 1) {
         fprintf(stderr, "Expected alphabet symbol to be a single character\n");
-        _printInputLocationFromToken(token, input);
-        exit(EXIT_FAILURE);
+        _printInputLocationFromToken(parser, token);
+        _parserFail(parser);
     }
 }
 
-void _printInputLocation(int line, int col, size_t size, const char *input) {
-    fprintf(stderr, "\nError at line %d:%d\n", line, col);
-
-    int lineCounter = 0, lastNewLine = 0, startIndex = 0, index = 0;
-    do {
-        if (input[index] == '\n' || input[index] == '\0' || input[index] == '\r') {
-            if (input[lastNewLine] == '\n') {
-                lastNewLine++;
-            }
-            startIndex = lastNewLine;
-            lastNewLine = index;
-            lineCounter++;
-        }
-        index++;
-    } while (lineCounter < line && input[index] != '\0');
-
-    size_t i = lastNewLine - startIndex;
-    char *lineStr;
-    if (!(lineStr = (char *)malloc(i))) {
-        fprintf(stderr, "Error allocating memory\n");
-        exit(EXIT_FAILURE);
+/*
+* Prints the line holding the token with size carets under it. The line is
+* only looked up here, the lexer does not track lines.
+*/
+void _printInputLocation(Parser *parser, Token token, size_t size) {
+    const char *input = lexerGetInput(parser->lexer);
+    size_t inputLength = lexerGetInputLength(parser->lexer);
+
+    lexerLocate(parser->lexer, &token);
+    fprintf(stderr, "\nError at line %d:%d\n", token.line, token.column);
+
+    size_t start = token.offset - (token.column - 1);
+    size_t end = start;
+    while (end < inputLength && input[end] != '\n' && input[end] != '\r' && input[end] != '\0') {
+        end++;
     }
-    memset(lineStr, 0, i + 1);
-    strncpy(lineStr, input + startIndex, i);
-    fprintf(stderr, "%s\n", lineStr);
+    fprintf(stderr, "%.*s\n", (int)(end - start), input + start);
 
-    for (int i = 0; i < col - 1; i++) {
+    for (int i = 0; i < token.column - 1; i++) {
         fprintf(stderr, " ");
     }
-    for (int i = 0; i < size; i++) {
+    for (size_t i = 0; i < size; i++) {
         fprintf(stderr, "^");
     }
 
     fprintf(stderr, "\n");
-
-    free(lineStr);
 }
 
-void _printInputLocationFromToken(Token token, const char *input) {
-    _printInputLocation(token.line, token.column, token.size, input);
+void _printInputLocationFromToken(Parser *parser, Token token) {
+    _printInputLocation(parser, token, token.size);
 }
@@ -8,9 +8,20 @@ extern "C" {
 #include "../lexer/lexer.h"
 #include "../fsm/fsm.h"
 
+/*
+* Flags of parserParseFileWith. PARSER_NONDETERMINISTIC accepts states
+* with several transitions on a symbol, or none, see
+* fsmSetNondeterministic.
+*/
+#define PARSER_NONDETERMINISTIC 1
+
 typedef struct SParser Parser;
 Parser *parserCreate(Lexer *lexer);
 Fsm *parserParse(Parser *parser);
+Fsm *parserTryParse(Parser *parser);
+Fsm *parserParseFile(const char *filename);
+Fsm *parserParseFileWith(const char *filename, int flags);
+void parserSetFlags(Parser *parser, int flags);
 void parserDestroy(Parser **parser);
 
 #ifdef __cplusplus
@@ -0,0 +1,716 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "server.h"
+#include "../fsm/fsm.h"
+#include "../parser/parser.h"
+
+#define SERVER_MAX_EVENTS 64
+#define SERVER_HEADER_SIZE 4
+#define SERVER_DEFINITION_SIZE 2
+#define SERVER_MAX_FRAME (16 * 1024 * 1024)
+#define SERVER_READ_SIZE (64 * 1024)
+#define SERVER_RELOAD_POLL_MS 50
+
+/*
+* Most a connection buffers either way. Past it the server stops reading
+* from the connection until the client catches up with the responses.
+*/
+#define SERVER_BUFFER_LIMIT (SERVER_HEADER_SIZE + SERVER_MAX_FRAME)
+
+typedef struct SServerConnection {
+    int fd;
+    char *in;
+    size_t inLength;
+    size_t inCapacity;
+    size_t parsed;
+    unsigned char *out;
+    size_t outLength;
+    size_t outCapacity;
+    size_t outSent;
+    uint32_t events;
+    int peerClosed;
+    int failed;
+    struct SServerConnection *prev;
+    struct SServerConnection *next;
+} ServerConnection;
+
+/*
+* A complete request frame, pointing into the input buffer of its
+* connection. Buffers are left alone until the whole batch is answered.
+*/
+typedef struct SServerRequest {
+    ServerConnection *connection;
+    size_t offset;
+    size_t len;
+    size_t definition;
+} ServerRequest;
+
+struct SServer {
+    char *socketPath;
+    int listenFd;
+    int epollFd;
+    int stopFd;
+    int signalFd;
+    int stopping;
+    int reloadPending;
+    char **definitions;
+    FsmPool *pool;
+    FsmCache *cache;
+    FsmShared **shared;
+    FsmReader **readers;
+    const FsmCompiled **current;
+    size_t definitionsCount;
+    ServerConnection *connections;
+    ServerConnection *ready[SERVER_MAX_EVENTS];
+    size_t readyCount;
+    ServerRequest *batch;
+    size_t batchCount;
+    size_t batchCapacity;
+};
+
+static int _serverLoad(Server *server, size_t index, const char *filename);
+static int _serverListen(Server *server);
+static int _serverWatch(Server *server, int fd, uint32_t events, void *ptr);
+static void _serverAccept(Server *server);
+static void _serverSignal(Server *server);
+static void _serverReload(Server *server);
+static void _serverPrintCacheStats(Server *server);
+static void _serverRead(Server *server, ServerConnection *connection);
+static int _serverAddRequest(Server *server, ServerConnection *connection, size_t offset, size_t len);
+static void _serverCheckBatch(Server *server);
+static int _serverAppend(ServerConnection *connection, unsigned char result);
+static void _serverFlush(ServerConnection *connection);
+static void _serverUpdate(Server *server, ServerConnection *connection);
+static void _serverClose(Server *server, ServerConnection *connection);
+static uint32_t _serverReadBe32(const char *bytes);
+static uint16_t _serverReadBe16(const char *bytes);
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+/*
+* Loads every definition once and binds the socket, replacing a stale
+* socket left at socketPath. Requests pick a definition by its index in
+* definitions. Definitions accepting the same strings share one table.
+*/
+Server *serverCreate(const char *socketPath, char **definitions, size_t definitionsCount) {
+    size_t len = sizeof(Server);
+
+    Server *server = malloc(len);
+    if (!server) {
+        fprintf(stderr, "Error allocating memory\n");
+        return NULL;
+    }
+    memset(server, 0, len);
+
+    server->listenFd = -1;
+    server->epollFd = -1;
+    server->stopFd = -1;
+    server->signalFd = -1;
+    server->definitionsCount = definitionsCount;
+    server->socketPath = strdup(socketPath);
+    server->definitions = calloc(definitionsCount + 1, sizeof(char *));
+    server->shared = calloc(definitionsCount + 1, sizeof(FsmShared *));
+    server->readers = calloc(definitionsCount + 1, sizeof(FsmReader *));
+    server->current = calloc(definitionsCount + 1, sizeof(FsmCompiled *));
+    server->pool = fsmPoolCreate();
+
+    if (!server->socketPath || !server->definitions || !server->shared || !server->readers || !server->current || !server->pool) {
+        fprintf(stderr, "Error allocating memory\n");
+        serverDestroy(&server);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < definitionsCount; i++) {
+        if (_serverLoad(server, i, definitions[i]) != 0) {
+            serverDestroy(&server);
+            return NULL;
+        }
+    }
+
+    if (_serverListen(server) != 0) {
+        serverDestroy(&server);
+        return NULL;
+    }
+
+    return server;
+}
+
+/*
+* Answers repeated inputs from a cache of capacity results shared by
+* every definition. Entries of a definition's previous versions age out
+* after a reload.
+*/
+int serverEnableCache(Server *server, size_t capacity) {
+    FsmCache *cache = fsmCacheCreate(capacity);
+
+    if (!cache) {
+        return 1;
+    }
+
+    fsmCacheDestroy(&server->cache);
+    server->cache = cache;
+    return 0;
+}
+
+int serverGetCacheStats(Server *server, FsmCacheStats *stats) {
+    if (!server->cache) {
+        return 1;
+    }
+
+    fsmCacheGetStats(server->cache, stats);
+    return 0;
+}
+
+/*
+* Handles SIGINT and SIGTERM by stopping, SIGHUP by reloading every
+* definition in the background and SIGUSR1 by printing the cache
+* counters. Blocks the four signals in the calling thread, call it
+* before starting any other thread.
+*/
+int serverHandleSignals(Server *server) {
+    sigset_t signals;
+
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    sigaddset(&signals, SIGUSR1);
+
+    if (sigprocmask(SIG_BLOCK, &signals, NULL) != 0 || (server->signalFd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        fprintf(stderr, "Error handling signals\n");
+        return 1;
+    }
+
+    return _serverWatch(server, server->signalFd, EPOLLIN, &server->signalFd);
+}
+
+/*
+* Serves until serverStop or a stop signal. Requests that arrive
+* together, over every connection, are checked in one pass.
+*/
+int serverRun(Server *server) {
+    struct epoll_event events[SERVER_MAX_EVENTS];
+
+    while (!server->stopping) {
+        /* Wake up to notice running reloads finish while another one waits */
+        int count = epoll_wait(server->epollFd, events, SERVER_MAX_EVENTS, server->reloadPending ? SERVER_RELOAD_POLL_MS : -1);
+
+        if (count < 0 && errno == EINTR) {
+            continue;
+        } else if (count < 0) {
+            fprintf(stderr, "Error waiting for events\n");
+            return 1;
+        }
+
+        server->batchCount = 0;
+        server->readyCount = 0;
+
+        for (int i = 0; i < count; i++) {
+            void *ptr = events[i].data.ptr;
+
+            if (ptr == &server->listenFd) {
+                _serverAccept(server);
+            } else if (ptr == &server->stopFd) {
+                server->stopping = 1;
+            } else if (ptr == &server->signalFd) {
+                _serverSignal(server);
+            } else {
+                ServerConnection *connection = ptr;
+
+                if (events[i].events & EPOLLOUT) {
+                    _serverFlush(connection);
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                    _serverRead(server, connection);
+                }
+
+                server->ready[server->readyCount++] = connection;
+            }
+        }
+
+        _serverReload(server);
+        _serverCheckBatch(server);
+
+        for (size_t i = 0; i < server->readyCount; i++) {
+            ServerConnection *connection = server->ready[i];
+
+            /* Keep only the unparsed tail of a frame */
+            if (connection->parsed > 0) {
+                memmove(connection->in, connection->in + connection->parsed, connection->inLength - connection->parsed);
+                connection->inLength -= connection->parsed;
+                connection->parsed = 0;
+            }
+
+            _serverFlush(connection);
+            _serverUpdate(server, connection);
+        }
+    }
+
+    return 0;
+}
+
+/*
+* Makes serverRun return, from any thread.
+*/
+void serverStop(Server *server) {
+    uint64_t one = 1;
+
+    if (write(server->stopFd, &one, sizeof(one)) != sizeof(one)) {
+        fprintf(stderr, "Error stopping server\n");
+    }
+}
+
+void serverDestroy(Server **server) {
+    if (*server) {
+        while ((*server)->connections) {
+            _serverClose(*server, (*server)->connections);
+        }
+
+        if ((*server)->listenFd >= 0) {
+            close((*server)->listenFd);
+            unlink((*server)->socketPath);
+        }
+        if ((*server)->epollFd >= 0) {
+            close((*server)->epollFd);
+        }
+        if ((*server)->stopFd >= 0) {
+            close((*server)->stopFd);
+        }
+        if ((*server)->signalFd >= 0) {
+            close((*server)->signalFd);
+        }
+
+        for (size_t i = 0; i < (*server)->definitionsCount; i++) {
+            if ((*server)->readers) {
+                fsmReaderDestroy(&(*server)->readers[i]);
+            }
+            if ((*server)->shared) {
+                fsmSharedDestroy(&(*server)->shared[i]);
+            }
+            if ((*server)->definitions) {
+                free((*server)->definitions[i]);
+            }
+        }
+
+        fsmPoolDestroy(&(*server)->pool);
+        fsmCacheDestroy(&(*server)->cache);
+        free((*server)->readers);
+        free((*server)->current);
+        free((*server)->shared);
+        free((*server)->definitions);
+        free((*server)->batch);
+        free((*server)->socketPath);
+        free(*server);
+    }
+
+    *server = NULL;
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+static int _serverLoad(Server *server, size_t index, const char *filename) {
+    Fsm *fsm = parserParseFile(filename);
+
+    if (!fsm) {
+        return 1;
+    }
+
+    FsmCompiled *compiled = fsmPoolCompile(server->pool, fsm);
+    fsmDestroy(&fsm);
+
+    if (!compiled) {
+        return 1;
+    }
+
+    server->shared[index] = fsmSharedCreate(compiled);
+    fsmCompiledRelease(&compiled);
+
+    if (!server->shared[index] || !(server->readers[index] = fsmReaderCreate(server->shared[index]))) {
+        return 1;
+    }
+    fsmSharedSetPool(server->shared[index], server->pool);
+
+    if (!(server->definitions[index] = strdup(filename))) {
+        fprintf(stderr, "Error allocating memory\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static int _serverListen(Server *server) {
+    struct sockaddr_un address;
+    struct stat st;
+
+    if (strlen(server->socketPath) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Error socket path '%s' is too long\n", server->socketPath);
+        return 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, server->socketPath);
+
+    if (stat(server->socketPath, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(server->socketPath);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        fprintf(stderr, "Error binding socket '%s'\n", server->socketPath);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+    server->listenFd = fd;
+
+    if (listen(fd, SOMAXCONN) != 0) {
+        fprintf(stderr, "Error listening on socket '%s'\n", server->socketPath);
+        return 1;
+    }
+
+    if ((server->epollFd = epoll_create1(EPOLL_CLOEXEC)) < 0 || (server->stopFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        fprintf(stderr, "Error creating event loop\n");
+        return 1;
+    }
+
+    if (_serverWatch(server, server->listenFd, EPOLLIN, &server->listenFd) != 0) {
+        return 1;
+    }
+
+    return _serverWatch(server, server->stopFd, EPOLLIN, &server->stopFd);
+}
+
+static int _serverWatch(Server *server, int fd, uint32_t events, void *ptr) {
+    struct epoll_event event;
+
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = ptr;
+
+    if (epoll_ctl(server->epollFd, EPOLL_CTL_ADD, fd, &event) != 0) {
+        fprintf(stderr, "Error watching descriptor\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+static void _serverAccept(Server *server) {
+    int fd;
+
+    while ((fd = accept4(server->listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        size_t len = sizeof(ServerConnection);
+        ServerConnection *connection = malloc(len);
+
+        if (!connection) {
+            fprintf(stderr, "Error allocating memory\n");
+            close(fd);
+            continue;
+        }
+        memset(connection, 0, len);
+
+        connection->fd = fd;
+        connection->events = EPOLLIN;
+
+        if (_serverWatch(server, fd, connection->events, connection) != 0) {
+            close(fd);
+            free(connection);
+            continue;
+        }
+
+        connection->next = server->connections;
+        if (server->connections) {
+            server->connections->prev = connection;
+        }
+        server->connections = connection;
+    }
+}
+
+static void _serverSignal(Server *server) {
+    struct signalfd_siginfo info;
+
+    while (read(server->signalFd, &info, sizeof(info)) == sizeof(info)) {
+        if (info.ssi_signo == SIGUSR1) {
+            _serverPrintCacheStats(server);
+            continue;
+        } else if (info.ssi_signo != SIGHUP) {
+            _serverPrintCacheStats(server);
+            server->stopping = 1;
+            continue;
+        }
+
+        /* Several SIGHUPs during a reload make one more */
+        server->reloadPending = 1;
+    }
+}
+
+/*
+* Reaps finished reloads and starts a pending one once the previous one
+* is over, never waiting for it. Each definition is published as soon as
+* it is ready, the loop keeps serving meanwhile.
+*/
+static void _serverReload(Server *server) {
+    int running = 0;
+
+    for (size_t i = 0; i < server->definitionsCount; i++) {
+        running |= fsmSharedReloadPoll(server->shared[i]) < 0;
+    }
+
+    if (running || !server->reloadPending) {
+        return;
+    }
+
+    for (size_t i = 0; i < server->definitionsCount; i++) {
+        fsmSharedReloadStart(server->shared[i], server->definitions[i]);
+    }
+
+    server->reloadPending = 0;
+}
+
+/*
+* One JSON line on stdout, so the cache can be sized from its hit rate.
+*/
+static void _serverPrintCacheStats(Server *server) {
+    FsmCacheStats stats;
+
+    if (serverGetCacheStats(server, &stats) != 0) {
+        return;
+    }
+
+    printf("{\"cache\":{\"hits\":%zu,\"misses\":%zu,\"bypassed\":%zu,\"evictions\":%zu,\"entries\":%zu,\"capacity\":%zu}}\n",
+        stats.hits, stats.misses, stats.bypassed, stats.evictions, stats.entries, stats.capacity);
+    fflush(stdout);
+}
+
+/*
+* Reads what the connection has, up to the buffer limit, and queues its
+* complete frames.
+*/
+static void _serverRead(Server *server, ServerConnection *connection) {
+    while (!connection->peerClosed && !connection->failed && connection->inLength < SERVER_BUFFER_LIMIT) {
+        if (connection->inCapacity - connection->inLength < SERVER_READ_SIZE && connection->inCapacity < SERVER_BUFFER_LIMIT) {
+            size_t capacity = connection->inCapacity ? connection->inCapacity * 2 : SERVER_READ_SIZE;
+            capacity = capacity < SERVER_BUFFER_LIMIT ? capacity : SERVER_BUFFER_LIMIT;
+
+            char *grown = realloc(connection->in, capacity);
+            if (!grown) {
+                fprintf(stderr, "Error allocating memory\n");
+                connection->failed = 1;
+                break;
+            }
+
+            connection->in = grown;
+            connection->inCapacity = capacity;
+        }
+
+        ssize_t len = read(connection->fd, connection->in + connection->inLength, connection->inCapacity - connection->inLength);
+
+        if (len > 0) {
+            connection->inLength += len;
+        } else if (len == 0) {
+            connection->peerClosed = 1;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else if (errno != EINTR) {
+            connection->failed = 1;
+        }
+    }
+
+    size_t position = connection->parsed;
+    while (!connection->failed && connection->inLength - position >= SERVER_HEADER_SIZE) {
+        uint32_t len = _serverReadBe32(connection->in + position);
+
+        if (len < SERVER_DEFINITION_SIZE || len > SERVER_MAX_FRAME) {
+            connection->failed = 1;
+        } else if (connection->inLength - position - SERVER_HEADER_SIZE < len) {
+            break;
+        } else if (_serverAddRequest(server, connection, position + SERVER_HEADER_SIZE, len) != 0) {
+            connection->failed = 1;
+        } else {
+            position += SERVER_HEADER_SIZE + len;
+        }
+    }
+    connection->parsed = position;
+}
+
+static int _serverAddRequest(Server *server, ServerConnection *connection, size_t offset, size_t len) {
+    if (server->batchCount >= server->batchCapacity) {
+        size_t capacity = server->batchCapacity ? server->batchCapacity * 2 : 256;
+        ServerRequest *grown = realloc(server->batch, capacity * sizeof(ServerRequest));
+
+        if (!grown) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+
+        server->batch = grown;
+        server->batchCapacity = capacity;
+    }
+
+    ServerRequest *request = &server->batch[server->batchCount++];
+    request->connection = connection;
+    request->definition = _serverReadBe16(connection->in + offset);
+    request->offset = offset + SERVER_DEFINITION_SIZE;
+    request->len = len - SERVER_DEFINITION_SIZE;
+    return 0;
+}
+
+/*
+* One matcher pass over every queued request, each definition is entered
+* once for the whole batch.
+*/
+static void _serverCheckBatch(Server *server) {
+    const FsmCompiled **current = server->current;
+
+    if (server->batchCount == 0) {
+        return;
+    }
+
+    for (size_t i = 0; i < server->definitionsCount; i++) {
+        current[i] = fsmReaderEnter(server->readers[i]);
+    }
+
+    for (size_t i = 0; i < server->batchCount; i++) {
+        ServerRequest *request = &server->batch[i];
+        ServerConnection *connection = request->connection;
+        unsigned char result = SERVER_UNKNOWN_DEFINITION;
+
+        if (request->definition < server->definitionsCount) {
+            const FsmCompiled *compiled = current[request->definition];
+            const char *input = connection->in + request->offset;
+            int accepted = server->cache ? fsmCacheCheck(server->cache, compiled, input, request->len) : fsmCompiledCheck(compiled, input, request->len);
+
+            result = accepted ? SERVER_ACCEPTED : SERVER_REJECTED;
+        }
+
+        if (!connection->failed && _serverAppend(connection, result) != 0) {
+            connection->failed = 1;
+        }
+    }
+
+    for (size_t i = 0; i < server->definitionsCount; i++) {
+        fsmReaderExit(server->readers[i]);
+    }
+}
+
+static int _serverAppend(ServerConnection *connection, unsigned char result) {
+    if (connection->outLength >= connection->outCapacity) {
+        size_t capacity = connection->outCapacity ? connection->outCapacity * 2 : 256;
+        unsigned char *grown = realloc(connection->out, capacity);
+
+        if (!grown) {
+            fprintf(stderr, "Error allocating memory\n");
+            return 1;
+        }
+
+        connection->out = grown;
+        connection->outCapacity = capacity;
+    }
+
+    connection->out[connection->outLength++] = result;
+    return 0;
+}
+
+static void _serverFlush(ServerConnection *connection) {
+    while (!connection->failed && connection->outSent < connection->outLength) {
+        ssize_t len = send(connection->fd, connection->out + connection->outSent, connection->outLength - connection->outSent, MSG_NOSIGNAL);
+
+        if (len > 0) {
+            connection->outSent += len;
+        } else if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else if (len < 0 && errno != EINTR) {
+            connection->failed = 1;
+        }
+    }
+
+    if (connection->outSent == connection->outLength) {
+        connection->outSent = 0;
+        connection->outLength = 0;
+    }
+}
+
+/*
+* Closes finished connections, and otherwise watches for input only while
+* the responses are not backed up and for output only while some wait.
+*/
+static void _serverUpdate(Server *server, ServerConnection *connection) {
+    size_t pending = connection->outLength - connection->outSent;
+
+    if (connection->failed || (connection->peerClosed && pending == 0)) {
+        _serverClose(server, connection);
+        return;
+    }
+
+    uint32_t events = 0;
+    if (!connection->peerClosed && pending < SERVER_BUFFER_LIMIT) {
+        events |= EPOLLIN;
+    }
+    if (pending > 0) {
+        events |= EPOLLOUT;
+    }
+
+    if (events != connection->events) {
+        struct epoll_event event;
+
+        memset(&event, 0, sizeof(event));
+        event.events = events;
+        event.data.ptr = connection;
+
+        if (epoll_ctl(server->epollFd, EPOLL_CTL_MOD, connection->fd, &event) != 0) {
+            _serverClose(server, connection);
+            return;
+        }
+        connection->events = events;
+    }
+}
+
+static void _serverClose(Server *server, ServerConnection *connection) {
+    epoll_ctl(server->epollFd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+
+    if (connection->prev) {
+        connection->prev->next = connection->next;
+    } else {
+        server->connections = connection->next;
+    }
+    if (connection->next) {
+        connection->next->prev = connection->prev;
+    }
+
+    free(connection->in);
+    free(connection->out);
+    free(connection);
+}
+
+static uint32_t _serverReadBe32(const char *bytes) {
+    const unsigned char *b = (const unsigned char *)bytes;
+
+    return ((uint32_t)b[0] << 24) | ((uint32_t)b[1] << 16) | ((uint32_t)b[2] << 8) | b[3];
+}
+
+static uint16_t _serverReadBe16(const char *bytes) {
+    const unsigned char *b = (const unsigned char *)bytes;
+
+    return (uint16_t)((b[0] << 8) | b[1]);
+}
@@ -0,0 +1,38 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+
+#include "../fsm/fsm.h"
+
+/*
+* Answers checks over a Unix domain socket. A request frame is a 4 byte
+* big-endian length followed by that many bytes: a 2 byte big-endian
+* definition index and the input. Each request is answered with a single
+* byte, in request order: SERVER_ACCEPTED, SERVER_REJECTED or
+* SERVER_UNKNOWN_DEFINITION. Any number of requests can be pipelined on
+* a connection.
+*/
+#define SERVER_REJECTED 0
+#define SERVER_ACCEPTED 1
+#define SERVER_UNKNOWN_DEFINITION 0xff
+
+typedef struct SServer Server;
+
+Server *serverCreate(const char *socketPath, char **definitions, size_t definitionsCount);
+int serverEnableCache(Server *server, size_t capacity);
+int serverGetCacheStats(Server *server, FsmCacheStats *stats);
+int serverHandleSignals(Server *server);
+int serverRun(Server *server);
+void serverStop(Server *server);
+void serverDestroy(Server **server);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SERVER_H_
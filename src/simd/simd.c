@@ -0,0 +1,168 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "simd.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SIMD_X86 1
+#include <immintrin.h>
+#endif
+
+typedef size_t (*SimdFind)(const SimdByteSet *set, const unsigned char *input, size_t len);
+
+static size_t _simdFindScalar(const SimdByteSet *set, const unsigned char *input, size_t len);
+static SimdFind _simdResolve(void);
+static void _simdInit(void);
+
+/* Picked once, by the first thread to search, for the CPU it runs on */
+static SimdFind _simdFind = NULL;
+static pthread_once_t _simdOnce = PTHREAD_ONCE_INIT;
+
+/*****************************************************************************
+*                              PUBLIC FUNCTIONS                              *
+******************************************************************************/
+
+void simdByteSetInit(SimdByteSet *set) {
+    memset(set, 0, sizeof(SimdByteSet));
+}
+
+void simdByteSetAdd(SimdByteSet *set, unsigned char byte) {
+    if (simdByteSetHas(set, byte)) {
+        return;
+    }
+
+    set->bits[byte >> 3] |= 1 << (byte & 7);
+    set->lowNibbles[byte >> 7][byte & 0x0f] |= 1 << ((byte >> 4) & 7);
+    set->count++;
+}
+
+int simdByteSetHas(const SimdByteSet *set, unsigned char byte) {
+    return (set->bits[byte >> 3] >> (byte & 7)) & 1;
+}
+
+/*
+* Returns the index of the first byte of input that is in the set, or len
+* when there is none.
+*/
+size_t simdFindInSet(const SimdByteSet *set, const char *input, size_t len) {
+    const unsigned char *bytes = (const unsigned char *)input;
+
+    if (set->count == 0) {
+        return len;
+    } else if (set->count == 1) {
+        for (size_t i = 0; i < 32; i++) {
+            if (set->bits[i]) {
+                const unsigned char *found = memchr(bytes, i * 8 + __builtin_ctz(set->bits[i]), len);
+                return found ? (size_t)(found - bytes) : len;
+            }
+        }
+    }
+
+    pthread_once(&_simdOnce, _simdInit);
+
+    return _simdFind(set, bytes, len);
+}
+
+/*****************************************************************************
+*                              PRIVATE FUNCTIONS                             *
+******************************************************************************/
+
+static void _simdInit(void) {
+    _simdFind = _simdResolve();
+}
+
+static size_t _simdFindScalar(const SimdByteSet *set, const unsigned char *input, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        if (simdByteSetHas(set, input[i])) {
+            return i;
+        }
+    }
+
+    return len;
+}
+
+#ifdef SIMD_X86
+
+/*
+* Each byte is split in its low and high nibble. The low nibble selects,
+* from one of two 16 byte tables depending on the top bit of the high
+* nibble, a mask of the high nibbles in the set; the byte is in the set
+* when that mask has the bit of its own high nibble.
+*/
+__attribute__((target("ssse3")))
+static size_t _simdFindSsse3(const SimdByteSet *set, const unsigned char *input, size_t len) {
+    const __m128i lowTable = _mm_loadu_si128((const __m128i *)set->lowNibbles[0]);
+    const __m128i highTable = _mm_loadu_si128((const __m128i *)set->lowNibbles[1]);
+    const __m128i highBits = _mm_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+    const __m128i seven = _mm_set1_epi8(7);
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i chunk = _mm_loadu_si128((const __m128i *)(input + i));
+        __m128i low = _mm_and_si128(chunk, nibble);
+        __m128i high = _mm_and_si128(_mm_srli_epi16(chunk, 4), nibble);
+        __m128i upper = _mm_cmpgt_epi8(high, seven);
+        __m128i masks = _mm_or_si128(
+            _mm_andnot_si128(upper, _mm_shuffle_epi8(lowTable, low)),
+            _mm_and_si128(upper, _mm_shuffle_epi8(highTable, low)));
+        __m128i hits = _mm_and_si128(masks, _mm_shuffle_epi8(highBits, high));
+        unsigned int found = _mm_movemask_epi8(_mm_cmpeq_epi8(hits, zero)) ^ 0xffff;
+
+        if (found) {
+            return i + __builtin_ctz(found);
+        }
+    }
+
+    return i + _simdFindScalar(set, input + i, len - i);
+}
+
+__attribute__((target("avx2")))
+static size_t _simdFindAvx2(const SimdByteSet *set, const unsigned char *input, size_t len) {
+    const __m256i lowTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lowNibbles[0]));
+    const __m256i highTable = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)set->lowNibbles[1]));
+    const __m256i highBits = _mm256_setr_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128,
+                                              1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+    const __m256i seven = _mm256_set1_epi8(7);
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32) {
+        __m256i chunk = _mm256_loadu_si256((const __m256i *)(input + i));
+        __m256i low = _mm256_and_si256(chunk, nibble);
+        __m256i high = _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble);
+        __m256i upper = _mm256_cmpgt_epi8(high, seven);
+        __m256i masks = _mm256_blendv_epi8(_mm256_shuffle_epi8(lowTable, low), _mm256_shuffle_epi8(highTable, low), upper);
+        __m256i hits = _mm256_and_si256(masks, _mm256_shuffle_epi8(highBits, high));
+        unsigned int found = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(hits, zero)) ^ 0xffffffffu;
+
+        if (found) {
+            return i + __builtin_ctz(found);
+        }
+    }
+
+    return i + _simdFindSsse3(set, input + i, len - i);
+}
+
+static SimdFind _simdResolve(void) {
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2")) {
+        return _simdFindAvx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        return _simdFindSsse3;
+    }
+
+    return _simdFindScalar;
+}
+
+#else
+
+static SimdFind _simdResolve(void) {
+    return _simdFindScalar;
+}
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef _SIMD_H_
+#define _SIMD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdlib.h>
+#include <stdint.h>
+
+/*
+* A set of byte values, searched 16 or 32 bytes at a time by splitting
+* each byte in two nibbles and looking both up with a shuffle. byteSetAdd
+* keeps the nibble tables in sync with the bitmap.
+*/
+typedef struct SSimdByteSet {
+    uint8_t bits[32];
+    uint8_t lowNibbles[2][16];
+    size_t count;
+} SimdByteSet;
+
+void simdByteSetInit(SimdByteSet *set);
+void simdByteSetAdd(SimdByteSet *set, unsigned char byte);
+int simdByteSetHas(const SimdByteSet *set, unsigned char byte);
+size_t simdFindInSet(const SimdByteSet *set, const char *input, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _SIMD_H_
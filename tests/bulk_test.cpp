@@ -0,0 +1,112 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <fstream>
+#include <string>
+
+#include "bulk/bulk.h"
+#include "fsm/fsm.h"
+#include "parser/parser.h"
+
+static FsmCompiled *_compileEndsOne(const char *directory) {
+    std::string path = std::string(directory) + "/definition.fsm";
+    std::ofstream(path) << "endsOne = s0, s1; 0, 1; s0,0,s0 | s0,1,s1 | s1,0,s0 | s1,1,s1; s0; s1";
+
+    Fsm *fsm = parserParseFile(path.c_str());
+    if (!fsm) {
+        return NULL;
+    }
+
+    FsmCompiled *compiled = fsmCompiledCreate(fsm);
+    fsmDestroy(&fsm);
+    unlink(path.c_str());
+    return compiled;
+}
+
+TEST(TestBulk, TestBulk_Directory) {
+    char directory[] = "/tmp/bulk_test_XXXXXX";
+    ASSERT_NE(mkdtemp(directory), nullptr);
+
+    FsmCompiled *compiled = _compileEndsOne(directory);
+    ASSERT_NE(compiled, nullptr);
+
+    std::string base(directory);
+
+    // Several read chunks, lines crossing their boundaries
+    std::string large;
+    size_t largeAccepted = 0;
+    size_t largeLines = 0;
+    while (large.size() < 3 * 1024 * 1024 + 7) {
+        std::string line(largeLines % 97, '0');
+        line += (largeLines % 3 == 0) ? '1' : '0';
+        largeAccepted += largeLines % 3 == 0;
+        largeLines++;
+        large += line + '\n';
+    }
+
+    std::ofstream(base + "/a_large") << large;
+    std::ofstream(base + "/b_empty");
+    std::ofstream(base + "/c_no_newline") << "01\n0x1\n\n11";
+    mkdir((base + "/d_directory").c_str(), 0700);
+
+    size_t count = 0;
+    char **files = bulkListFiles(directory, &count);
+    ASSERT_NE(files, nullptr);
+    ASSERT_EQ(count, 3u);
+    EXPECT_EQ(std::string(files[0]), base + "/a_large");
+    EXPECT_EQ(std::string(files[1]), base + "/b_empty");
+    EXPECT_EQ(std::string(files[2]), base + "/c_no_newline");
+
+    BulkResult results[3];
+    ASSERT_EQ(bulkCheckFiles(compiled, files, count, 2, results), 0);
+
+    EXPECT_EQ(results[0].lines, largeLines);
+    EXPECT_EQ(results[0].accepted, largeAccepted);
+    EXPECT_EQ(results[0].error, 0);
+    EXPECT_EQ(results[1].lines, 0u);
+    EXPECT_EQ(results[1].accepted, 0u);
+    EXPECT_EQ(results[2].lines, 4u);
+    EXPECT_EQ(results[2].accepted, 2u);
+
+    for (size_t i = 0; i < count; i++) {
+        unlink(files[i]);
+    }
+    bulkFreeList(&files, count);
+    EXPECT_EQ(files, nullptr);
+
+    rmdir((base + "/d_directory").c_str());
+    rmdir(directory);
+    fsmCompiledRelease(&compiled);
+}
+
+TEST(TestBulk, TestBulk_FileList) {
+    char directory[] = "/tmp/bulk_test_XXXXXX";
+    ASSERT_NE(mkdtemp(directory), nullptr);
+
+    FsmCompiled *compiled = _compileEndsOne(directory);
+    ASSERT_NE(compiled, nullptr);
+
+    std::string base(directory);
+    std::ofstream(base + "/one") << "1\n0\n";
+    std::ofstream(base + "/list") << base + "/one\n" << base + "/missing\n";
+
+    size_t count = 0;
+    char **files = bulkListFiles((base + "/list").c_str(), &count);
+    ASSERT_NE(files, nullptr);
+    ASSERT_EQ(count, 2u);
+
+    BulkResult results[2];
+    EXPECT_NE(bulkCheckFiles(compiled, files, count, 1, results), 0);
+
+    EXPECT_EQ(results[0].lines, 2u);
+    EXPECT_EQ(results[0].accepted, 1u);
+    EXPECT_EQ(results[0].error, 0);
+    EXPECT_NE(results[1].error, 0);
+
+    bulkFreeList(&files, count);
+    unlink((base + "/one").c_str());
+    unlink((base + "/list").c_str());
+    rmdir(directory);
+    fsmCompiledRelease(&compiled);
+}
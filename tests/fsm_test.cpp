@@ -1,6 +1,12 @@
 #include <gtest/gtest.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <fstream>
+#include <thread>
 
 #include "fsm/fsm.h"
+#include "parser/parser.h"
 
 TEST(TestFsm, TestFsm_One) {
     Fsm *fsm = fsmCreate(strdup("One"));
@@ -27,3 +33,1075 @@ TEST(TestFsm, TestFsm_One) {
 
     fsmDestroy(&fsm);
 }
+
+TEST(TestFsm, TestFsm_ValidateTransitions) {
+    Fsm *fsm = fsmCreate(strdup("Invalid"));
+    FsmValidation validation;
+
+    fsmAddState(fsm, strdup("s0"));
+    fsmAddState(fsm, strdup("s1"));
+    fsmAddState(fsm, strdup("s2"));
+
+    fsmAddToAlphabet(fsm, '0');
+    fsmAddToAlphabet(fsm, '1');
+
+    fsmAddTransition(fsm, strdup("s0"), '0', strdup("s0"));
+    fsmAddTransition(fsm, strdup("s0"), '1', strdup("s1"));
+    fsmAddTransition(fsm, strdup("s0"), '1', strdup("s0"));
+    fsmAddTransition(fsm, strdup("s1"), '0', strdup("s0"));
+    fsmAddTransition(fsm, strdup("s2"), '0', strdup("s0"));
+    fsmAddTransition(fsm, strdup("s2"), '1', strdup("s0"));
+
+    ASSERT_EQ(fsmValidateTransitions(fsm, &validation), 1);
+    ASSERT_EQ(validation.count, 3);
+
+    EXPECT_EQ(validation.diagnostics[0].type, FSM_DIAG_DUPLICATE_TRANSITION);
+    EXPECT_STREQ(validation.diagnostics[0].state, "s0");
+    EXPECT_EQ(validation.diagnostics[0].symbol, '1');
+    EXPECT_EQ(validation.diagnostics[0].count, 2);
+
+    EXPECT_EQ(validation.diagnostics[1].type, FSM_DIAG_MISSING_TRANSITION);
+    EXPECT_STREQ(validation.diagnostics[1].state, "s1");
+    EXPECT_EQ(validation.diagnostics[1].symbol, '1');
+
+    EXPECT_EQ(validation.diagnostics[2].type, FSM_DIAG_NO_INCOMING_TRANSITION);
+    EXPECT_STREQ(validation.diagnostics[2].state, "s2");
+
+    fsmValidationDestroy(&validation);
+
+    fsmAddTransition(fsm, strdup("s1"), '1', strdup("s2"));
+    ASSERT_EQ(fsmValidateTransitions(fsm, NULL), 1);
+
+    fsmDestroy(&fsm);
+}
+
+static Fsm *_createChain(size_t length) {
+    const char *symbols = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+    Fsm *fsm = fsmCreate(strdup("Chain"));
+    char name[16];
+
+    for (size_t i = 0; i <= length; i++) {
+        snprintf(name, sizeof(name), "s%zu", i);
+        fsmAddState(fsm, strdup(name));
+    }
+    fsmAddState(fsm, strdup("reject"));
+
+    for (size_t i = 0; symbols[i] != '\0'; i++) {
+        fsmAddToAlphabet(fsm, symbols[i]);
+    }
+
+    // s0 -a-> s1 -b-> s2 -a-> ... everything else falls into reject
+    for (size_t i = 0; i <= length; i++) {
+        snprintf(name, sizeof(name), "s%zu", i);
+
+        for (size_t j = 0; symbols[j] != '\0'; j++) {
+            char next[16];
+            if (i < length && symbols[j] == (i % 2 ? 'b' : 'a')) {
+                snprintf(next, sizeof(next), "s%zu", i + 1);
+            } else {
+                snprintf(next, sizeof(next), "reject");
+            }
+            fsmAddTransition(fsm, strdup(name), symbols[j], strdup(next));
+        }
+    }
+    for (size_t j = 0; symbols[j] != '\0'; j++) {
+        fsmAddTransition(fsm, strdup("reject"), symbols[j], strdup("reject"));
+    }
+
+    fsmAddStartState(fsm, strdup("s0"));
+    snprintf(name, sizeof(name), "s%zu", length);
+    fsmAddAcceptState(fsm, strdup(name));
+
+    return fsm;
+}
+
+TEST(TestFsm, TestFsm_Layouts) {
+    Fsm *fsm = _createChain(600);
+    FsmTableInfo info;
+    std::string accepted;
+
+    for (size_t i = 0; i < 600; i++) {
+        accepted += i % 2 ? 'b' : 'a';
+    }
+
+    ASSERT_EQ(fsmGetTableInfo(fsm, &info), 0);
+    EXPECT_EQ(info.layout, FSM_LAYOUT_CSR);
+    EXPECT_EQ(info.states, 602);
+    EXPECT_EQ(info.entries, 600);
+
+    FsmLayout layouts[] = { FSM_LAYOUT_DENSE, FSM_LAYOUT_CSR };
+    for (FsmLayout layout : layouts) {
+        ASSERT_EQ(fsmSetLayout(fsm, layout), 0);
+        ASSERT_EQ(fsmGetTableInfo(fsm, &info), 0);
+        EXPECT_EQ(info.layout, layout);
+
+        EXPECT_EQ(fsmCheck(fsm, (char *)accepted.c_str()), 1);
+        EXPECT_EQ(fsmCheck(fsm, (char *)accepted.substr(0, 599).c_str()), 0);
+        EXPECT_EQ(fsmCheck(fsm, (char *)(accepted + "a").c_str()), 0);
+        EXPECT_EQ(fsmCheck(fsm, (char *)"abbb"), 0);
+        EXPECT_EQ(fsmCheck(fsm, (char *)"ab-"), 0);
+    }
+
+    FsmTableInfo dense;
+    fsmSetLayout(fsm, FSM_LAYOUT_DENSE);
+    fsmGetTableInfo(fsm, &dense);
+    fsmSetLayout(fsm, FSM_LAYOUT_CSR);
+    fsmGetTableInfo(fsm, &info);
+    EXPECT_LT(info.memory * 4, dense.memory);
+
+    fsmDestroy(&fsm);
+}
+
+TEST(TestFsm, TestFsm_Stats) {
+    Fsm *fsm = fsmCreate(strdup("Stats"));
+    FsmStats stats;
+
+    if (fsmEnableStats(fsm, 1) != 0) {
+        fsmDestroy(&fsm);
+        GTEST_SKIP() << "built without FSM_STATS";
+    }
+
+    fsmAddState(fsm, strdup("s0"));
+    fsmAddState(fsm, strdup("s1"));
+    fsmAddToAlphabet(fsm, '0');
+    fsmAddToAlphabet(fsm, '1');
+    fsmAddTransition(fsm, strdup("s0"), '0', strdup("s0"));
+    fsmAddTransition(fsm, strdup("s0"), '1', strdup("s1"));
+    fsmAddTransition(fsm, strdup("s1"), '1', strdup("s1"));
+    fsmAddStartState(fsm, strdup("s0"));
+    fsmAddAcceptState(fsm, strdup("s1"));
+
+    EXPECT_EQ(fsmCheck(fsm, (char *)"011"), 1);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"0a"), 0);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"10"), 0);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"00"), 0);
+
+    ASSERT_EQ(fsmGetStats(fsm, &stats), 0);
+    EXPECT_EQ(stats.inputsChecked, 4);
+    EXPECT_EQ(stats.bytesProcessed, 9);
+    EXPECT_EQ(stats.accepts, 1);
+    EXPECT_EQ(stats.rejectsBadSymbol, 1);
+    EXPECT_EQ(stats.rejectsNoTransition, 1);
+    EXPECT_EQ(stats.rejectsNotAccepting, 1);
+    ASSERT_EQ(stats.statesCount, 2);
+    EXPECT_EQ(stats.stateVisits[0], 8);
+    EXPECT_EQ(stats.stateVisits[1], 3);
+
+    fsmResetStats(fsm);
+    fsmEnableStats(fsm, 0);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"011"), 1);
+
+    ASSERT_EQ(fsmGetStats(fsm, &stats), 0);
+    EXPECT_EQ(stats.inputsChecked, 0);
+    EXPECT_EQ(stats.stateVisits[0], 0);
+
+    fsmDestroy(&fsm);
+}
+
+TEST(TestFsm, TestFsm_StateOrder) {
+    Fsm *fsm = _createChain(10);
+    FsmProfile *profile = fsmProfileCreate();
+    FsmProfile *loaded = NULL;
+    char path[] = "/tmp/fsm_test_profile_XXXXXX";
+    int fd = mkstemp(path);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    FsmOrder orders[] = { FSM_ORDER_DEFINITION, FSM_ORDER_BFS };
+    for (FsmOrder order : orders) {
+        ASSERT_EQ(fsmSetStateOrder(fsm, order, NULL), 0);
+        EXPECT_EQ(fsmCheck(fsm, (char *)"ababababab"), 1);
+        EXPECT_EQ(fsmCheck(fsm, (char *)"abababab"), 0);
+    }
+    EXPECT_NE(fsmSetStateOrder(fsm, FSM_ORDER_PROFILE, NULL), 0);
+
+    ASSERT_EQ(fsmProfileAddSample(profile, fsm, (char *)"abab"), 0);
+    ASSERT_EQ(fsmProfileAddSample(profile, fsm, (char *)"abz"), 0);
+    EXPECT_EQ(fsmProfileGetCount(profile, (char *)"s0"), 2);
+    EXPECT_EQ(fsmProfileGetCount(profile, (char *)"s2"), 2);
+    EXPECT_EQ(fsmProfileGetCount(profile, (char *)"s3"), 1);
+    EXPECT_EQ(fsmProfileGetCount(profile, (char *)"reject"), 1);
+    EXPECT_EQ(fsmProfileGetCount(profile, (char *)"s9"), 0);
+
+    ASSERT_EQ(fsmProfileSave(profile, path), 0);
+    ASSERT_NE(loaded = fsmProfileLoad(path), nullptr);
+    EXPECT_EQ(fsmProfileGetCount(loaded, (char *)"s2"), 2);
+    EXPECT_EQ(fsmProfileGetCount(loaded, (char *)"reject"), 1);
+
+    ASSERT_EQ(fsmSetStateOrder(fsm, FSM_ORDER_PROFILE, loaded), 0);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"ababababab"), 1);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"ababababa"), 0);
+
+    if (fsmEnableStats(fsm, 1) == 0) {
+        FsmStats stats;
+        fsmCheck(fsm, (char *)"abz");
+        fsmGetStats(fsm, &stats);
+        // Visits stay keyed by definition index whatever the row order
+        EXPECT_EQ(stats.stateVisits[0], 1);
+        EXPECT_EQ(stats.stateVisits[11], 1);
+    }
+
+    unlink(path);
+    fsmProfileDestroy(&profile);
+    fsmProfileDestroy(&loaded);
+    fsmDestroy(&fsm);
+}
+
+TEST(TestFsm, TestFsm_CellWidths) {
+    size_t lengths[] = { 10, 300, 70000 };
+    size_t cellSizes[] = { 1, 2, 4 };
+    char name[16], next[16];
+
+    for (size_t t = 0; t < 3; t++) {
+        Fsm *fsm = fsmCreate(strdup("Binary"));
+        FsmTableInfo info;
+        size_t length = lengths[t];
+
+        for (size_t i = 0; i <= length; i++) {
+            snprintf(name, sizeof(name), "s%zu", i);
+            fsmAddState(fsm, strdup(name));
+        }
+        fsmAddToAlphabet(fsm, '0');
+        fsmAddToAlphabet(fsm, '1');
+
+        // Counts the ones, saturating at length
+        for (size_t i = 0; i <= length; i++) {
+            snprintf(name, sizeof(name), "s%zu", i);
+            snprintf(next, sizeof(next), "s%zu", i < length ? i + 1 : i);
+            fsmAddTransition(fsm, strdup(name), '0', strdup(name));
+            fsmAddTransition(fsm, strdup(name), '1', strdup(next));
+        }
+        fsmAddStartState(fsm, strdup("s0"));
+        snprintf(name, sizeof(name), "s%zu", length - 1);
+        fsmAddAcceptState(fsm, strdup(name));
+
+        ASSERT_EQ(fsmGetTableInfo(fsm, &info), 0);
+        EXPECT_EQ(info.cellSize, cellSizes[t]);
+
+        std::string input(length - 1, '1');
+        EXPECT_EQ(fsmCheck(fsm, (char *)input.c_str()), 1);
+        EXPECT_EQ(fsmCheck(fsm, (char *)(input + "0").c_str()), 1);
+        EXPECT_EQ(fsmCheck(fsm, (char *)(input + "1").c_str()), 0);
+        EXPECT_EQ(fsmCheck(fsm, (char *)(input + "2").c_str()), 0);
+
+        fsmDestroy(&fsm);
+    }
+}
+
+static std::vector<size_t> _bruteForceEnds(Fsm *fsm, const std::string &input) {
+    std::vector<size_t> ends;
+
+    for (size_t end = 1; end <= input.size(); end++) {
+        for (size_t start = 0; start < end; start++) {
+            if (fsmCheck(fsm, (char *)input.substr(start, end - start).c_str())) {
+                ends.push_back(end);
+                break;
+            }
+        }
+    }
+
+    return ends;
+}
+
+static int _collectEnd(size_t end, void *context) {
+    ((std::vector<size_t> *)context)->push_back(end);
+    return 0;
+}
+
+TEST(TestFsm, TestFsm_Scan) {
+    // a followed by exactly 'length' symbols: its unanchored DFA has 2^length states
+    size_t lengths[] = { 3, 13 };
+    char name[16], next[16];
+
+    for (size_t length : lengths) {
+        Fsm *fsm = fsmCreate(strdup("Window"));
+
+        fsmAddState(fsm, strdup("dead"));
+        for (size_t i = 0; i <= length + 1; i++) {
+            snprintf(name, sizeof(name), "s%zu", i);
+            fsmAddState(fsm, strdup(name));
+        }
+        fsmAddToAlphabet(fsm, 'a');
+        fsmAddToAlphabet(fsm, 'b');
+
+        fsmAddTransition(fsm, strdup("s0"), 'a', strdup("s1"));
+        fsmAddTransition(fsm, strdup("s0"), 'b', strdup("dead"));
+        for (size_t i = 1; i <= length; i++) {
+            snprintf(name, sizeof(name), "s%zu", i);
+            snprintf(next, sizeof(next), "s%zu", i + 1);
+            fsmAddTransition(fsm, strdup(name), 'a', strdup(next));
+            fsmAddTransition(fsm, strdup(name), 'b', strdup(next));
+        }
+        fsmAddStartState(fsm, strdup("s0"));
+        snprintf(name, sizeof(name), "s%zu", length + 1);
+        fsmAddAcceptState(fsm, strdup(name));
+
+        std::string input;
+        unsigned int seed = 7;
+        for (size_t i = 0; i < 300; i++) {
+            seed = seed * 1103515245 + 12345;
+            input += "abbbbbbbbbbbbbbbx"[(seed >> 16) % 17];
+        }
+
+        std::vector<size_t> expected = _bruteForceEnds(fsm, input);
+        ASSERT_FALSE(expected.empty());
+
+        // Whole buffer
+        std::vector<size_t> ends(expected.size() + 4);
+        ASSERT_EQ(fsmScan(fsm, input.c_str(), input.size(), ends.data(), ends.size()), expected.size());
+        ends.resize(expected.size());
+        EXPECT_EQ(ends, expected);
+
+        // Odd sized chunks
+        std::vector<size_t> chunked;
+        FsmScanner *scanner = fsmScannerCreate(fsm);
+        ASSERT_NE(scanner, nullptr);
+        for (size_t offset = 0; offset < input.size(); offset += 7) {
+            size_t len = std::min<size_t>(7, input.size() - offset);
+            fsmScannerFeed(scanner, input.c_str() + offset, len, _collectEnd, &chunked);
+        }
+        EXPECT_EQ(fsmScannerGetOffset(scanner), input.size());
+        EXPECT_EQ(chunked, expected);
+
+        fsmScannerReset(scanner);
+        chunked.clear();
+        fsmScannerFeed(scanner, "bbabbbbbbbbbbbbbb", 17, _collectEnd, &chunked);
+        EXPECT_EQ(chunked, std::vector<size_t>(1, length + 3));
+
+        fsmScannerDestroy(&scanner);
+        fsmDestroy(&fsm);
+    }
+}
+
+TEST(TestFsm, TestFsm_SelfLoopAcceleration) {
+    const char *symbols = "abcdefghijklmnopqrstuvwxyz";
+    Fsm *fsm = fsmCreate(strdup("Sparse"));
+    FsmTableInfo info;
+
+    // Waits for "xy", anything else keeps (or puts) it back waiting
+    fsmAddState(fsm, strdup("wait"));
+    fsmAddState(fsm, strdup("x"));
+    fsmAddState(fsm, strdup("xy"));
+    for (size_t i = 0; symbols[i] != '\0'; i++) {
+        char c = symbols[i];
+        fsmAddToAlphabet(fsm, c);
+        fsmAddTransition(fsm, strdup("wait"), c, strdup(c == 'x' ? "x" : "wait"));
+        fsmAddTransition(fsm, strdup("x"), c, strdup(c == 'y' ? "xy" : c == 'x' ? "x" : "wait"));
+        fsmAddTransition(fsm, strdup("xy"), c, strdup(c == 'x' ? "x" : "wait"));
+    }
+    fsmAddStartState(fsm, strdup("wait"));
+    fsmAddAcceptState(fsm, strdup("xy"));
+
+    ASSERT_EQ(fsmGetTableInfo(fsm, &info), 0);
+    EXPECT_GE(info.accelerated, 1);
+
+    std::string input;
+    unsigned int seed = 3;
+    for (size_t i = 0; i < 2000; i++) {
+        seed = seed * 1103515245 + 12345;
+        input += (seed >> 16) % 97 == 0 ? "xy" : (seed >> 16) % 89 == 0 ? "x" : "abcdefgh";
+    }
+
+    EXPECT_EQ(fsmCheck(fsm, (char *)(input + "xy").c_str()), 1);
+    EXPECT_EQ(fsmCheck(fsm, (char *)(input + "xya").c_str()), 0);
+    EXPECT_EQ(fsmCheck(fsm, (char *)(input + "x1y").c_str()), 0);
+
+    std::vector<size_t> expected;
+    for (size_t i = 1; i < input.size(); i++) {
+        if (input[i - 1] == 'x' && input[i] == 'y') {
+            expected.push_back(i + 1);
+        }
+    }
+    std::vector<size_t> ends(expected.size());
+    ASSERT_EQ(fsmScan(fsm, input.c_str(), input.size(), ends.data(), ends.size()), expected.size());
+    EXPECT_EQ(ends, expected);
+
+    fsmDestroy(&fsm);
+}
+
+TEST(TestFsm, TestFsm_Compiled) {
+    Fsm *fsm = _createChain(3);
+    FsmCompiled *compiled = fsmCompiledCreate(fsm);
+
+    ASSERT_NE(compiled, nullptr);
+    EXPECT_STREQ(fsmCompiledGetName(compiled), fsmGetName(fsm));
+    EXPECT_EQ(fsmCompiledGetStatesCount(compiled), fsmGetStatesCount(fsm));
+    EXPECT_EQ(fsmCompiledCheck(compiled, "aba", 3), fsmCheck(fsm, (char *)"aba"));
+    EXPECT_EQ(fsmCompiledCheck(compiled, "ab", 2), 0);
+
+    // The snapshot outlives the builder it was compiled from
+    fsmDestroy(&fsm);
+    FsmCompiled *other = fsmCompiledRetain(compiled);
+    fsmCompiledRelease(&compiled);
+    EXPECT_EQ(compiled, nullptr);
+    EXPECT_STREQ(fsmCompiledGetStateName(other, 0), "s0");
+
+    FsmStats stats;
+    memset(&stats, 0, sizeof(FsmStats));
+    EXPECT_EQ(fsmCompiledCheckStats(other, "aba", 3, &stats), 0);
+    EXPECT_EQ(stats.inputsChecked, 0);
+
+    std::vector<size_t> visits(fsmCompiledGetStatesCount(other));
+    stats.statesCount = visits.size();
+    stats.stateVisits = visits.data();
+    EXPECT_EQ(fsmCompiledCheckStats(other, "aba", 3, &stats), 1);
+    EXPECT_EQ(fsmCompiledCheckStats(other, "abb", 3, &stats), 0);
+    EXPECT_EQ(stats.inputsChecked, 2);
+    EXPECT_EQ(stats.accepts, 1);
+    EXPECT_EQ(visits[0], 2);
+
+    fsmCompiledRelease(&other);
+}
+
+static Fsm *_createFromTransitions(const char *name, const char *alphabet, const char *start, const char *accept, const char *transitions[][3]) {
+    Fsm *fsm = fsmCreate(strdup(name));
+
+    for (; *alphabet; alphabet++) {
+        fsmAddToAlphabet(fsm, *alphabet);
+    }
+    for (size_t i = 0; transitions[i][0]; i++) {
+        for (size_t j = 0; j < 3; j += 2) {
+            size_t k = 0;
+            while (k < fsmGetStatesCount(fsm) && strcmp(fsmGetStateName(fsm, k), transitions[i][j]) != 0) {
+                k++;
+            }
+            if (k == fsmGetStatesCount(fsm)) {
+                fsmAddState(fsm, strdup(transitions[i][j]));
+            }
+        }
+        fsmAddTransition(fsm, strdup(transitions[i][0]), transitions[i][1][0], strdup(transitions[i][2]));
+    }
+    fsmAddStartState(fsm, strdup(start));
+    fsmAddAcceptState(fsm, strdup(accept));
+
+    return fsm;
+}
+
+TEST(TestFsm, TestFsm_Pool) {
+    const char *endsOne[][3] = {
+        { "s0", "0", "s0" }, { "s0", "1", "s1" }, { "s1", "0", "s0" }, { "s1", "1", "s1" }, { NULL }
+    };
+    // Same strings: a and c are equivalent, dead and unused are dropped
+    const char *renamed[][3] = {
+        { "a", "1", "b" }, { "a", "0", "c" }, { "a", "x", "dead" }, { "b", "0", "c" }, { "b", "1", "b" },
+        { "c", "0", "c" }, { "c", "1", "b" }, { "dead", "x", "dead" }, { "unused", "1", "b" }, { NULL }
+    };
+    const char *endsZero[][3] = {
+        { "s0", "0", "s1" }, { "s0", "1", "s0" }, { "s1", "0", "s1" }, { "s1", "1", "s0" }, { NULL }
+    };
+
+    Fsm *one = _createFromTransitions("endsOne", "01", "s0", "s1", endsOne);
+    Fsm *other = _createFromTransitions("renamed", "x10", "a", "b", renamed);
+    Fsm *zero = _createFromTransitions("endsZero", "01", "s0", "s1", endsZero);
+    uint64_t oneHash, otherHash, zeroHash;
+
+    ASSERT_EQ(fsmGetCanonicalHash(one, &oneHash), 0);
+    ASSERT_EQ(fsmGetCanonicalHash(other, &otherHash), 0);
+    ASSERT_EQ(fsmGetCanonicalHash(zero, &zeroHash), 0);
+    EXPECT_EQ(oneHash, otherHash);
+    EXPECT_NE(oneHash, zeroHash);
+
+    FsmPool *pool = fsmPoolCreate();
+    ASSERT_NE(pool, nullptr);
+
+    FsmCompiled *compiledOne = fsmPoolCompile(pool, one);
+    FsmCompiled *compiledOther = fsmPoolCompile(pool, other);
+    ASSERT_NE(compiledOne, nullptr);
+    ASSERT_NE(compiledOther, nullptr);
+    EXPECT_EQ(fsmPoolGetTablesCount(pool), 1);
+
+    FsmCompiled *compiledZero = fsmPoolCompile(pool, zero);
+    ASSERT_NE(compiledZero, nullptr);
+    EXPECT_EQ(fsmPoolGetTablesCount(pool), 2);
+
+    // Each keeps its own names over the shared table
+    EXPECT_STREQ(fsmCompiledGetName(compiledOther), "renamed");
+    EXPECT_EQ(fsmCompiledGetStatesCount(compiledOther), 5);
+    EXPECT_STREQ(fsmCompiledGetStateName(compiledOther, 3), "dead");
+
+    for (const char *input : { "", "1", "0110", "0x1", "10" }) {
+        EXPECT_EQ(fsmCompiledCheck(compiledOne, input, strlen(input)), fsmCheck(one, (char *)input));
+        EXPECT_EQ(fsmCompiledCheck(compiledOther, input, strlen(input)), fsmCheck(other, (char *)input));
+        EXPECT_EQ(fsmCompiledCheck(compiledZero, input, strlen(input)), fsmCheck(zero, (char *)input));
+    }
+
+    FsmTableInfo info;
+    fsmCompiledGetTableInfo(compiledOther, &info);
+    EXPECT_EQ(info.states, 2);
+    EXPECT_EQ(info.classes, 2);
+
+    // Visits of merged states count for the first of them
+    std::vector<size_t> visits(fsmCompiledGetStatesCount(compiledOther));
+    FsmStats stats;
+    memset(&stats, 0, sizeof(FsmStats));
+    stats.statesCount = visits.size();
+    stats.stateVisits = visits.data();
+    EXPECT_EQ(fsmCompiledCheckStats(compiledOther, "001", 3, &stats), 1);
+    EXPECT_EQ(visits, std::vector<size_t>({ 3, 1, 0, 0, 0 }));
+
+    fsmCompiledRelease(&compiledOne);
+    EXPECT_EQ(fsmPoolGetTablesCount(pool), 2);
+    fsmCompiledRelease(&compiledOther);
+    fsmCompiledRelease(&compiledZero);
+    EXPECT_EQ(fsmPoolGetTablesCount(pool), 0);
+
+    // Dead states are trimmed from the canonical table
+    Fsm *chain = _createChain(3);
+    FsmCompiled *compiledChain = fsmPoolCompile(pool, chain);
+    ASSERT_NE(compiledChain, nullptr);
+    fsmCompiledGetTableInfo(compiledChain, &info);
+    EXPECT_EQ(info.states, 4);
+    EXPECT_EQ(info.classes, 2);
+    EXPECT_EQ(fsmCompiledCheck(compiledChain, "aba", 3), 1);
+    EXPECT_EQ(fsmCompiledCheck(compiledChain, "abz", 3), 0);
+
+    fsmCompiledRelease(&compiledChain);
+    fsmPoolDestroy(&pool);
+    EXPECT_EQ(pool, nullptr);
+    fsmDestroy(&chain);
+    fsmDestroy(&one);
+    fsmDestroy(&other);
+    fsmDestroy(&zero);
+}
+
+// Accepts strings over a, b whose k-th symbol from the end is an a
+static Fsm *_createKthFromEnd(size_t k) {
+    Fsm *fsm = fsmCreate(strdup("KthFromEnd"));
+    char name[16], next[16];
+
+    for (size_t i = 0; i <= k; i++) {
+        snprintf(name, sizeof(name), "q%zu", i);
+        fsmAddState(fsm, strdup(name));
+    }
+    fsmAddToAlphabet(fsm, 'a');
+    fsmAddToAlphabet(fsm, 'b');
+    fsmSetNondeterministic(fsm, 1);
+
+    fsmAddTransition(fsm, strdup("q0"), 'a', strdup("q0"));
+    fsmAddTransition(fsm, strdup("q0"), 'b', strdup("q0"));
+    fsmAddTransition(fsm, strdup("q0"), 'a', strdup("q1"));
+    for (size_t i = 1; i < k; i++) {
+        snprintf(name, sizeof(name), "q%zu", i);
+        snprintf(next, sizeof(next), "q%zu", i + 1);
+        fsmAddTransition(fsm, strdup(name), 'a', strdup(next));
+        fsmAddTransition(fsm, strdup(name), 'b', strdup(next));
+    }
+
+    fsmAddStartState(fsm, strdup("q0"));
+    snprintf(name, sizeof(name), "q%zu", k);
+    fsmAddAcceptState(fsm, strdup(name));
+
+    return fsm;
+}
+
+TEST(TestFsm, TestFsm_Nondeterministic) {
+    // One, two and four words of active states
+    size_t ks[] = { 20, 100, 200 };
+    size_t cellSizes[] = { 8, 16, 32 };
+
+    for (size_t i = 0; i < 3; i++) {
+        size_t k = ks[i];
+        Fsm *fsm = _createKthFromEnd(k);
+        FsmTableInfo info;
+
+        ASSERT_EQ(fsmGetTableInfo(fsm, &info), 0);
+        EXPECT_EQ(info.engine, FSM_ENGINE_BITPARALLEL);
+        EXPECT_EQ(info.states, k + 1);
+        EXPECT_EQ(info.cellSize, cellSizes[i]);
+
+        srand(k);
+        for (size_t n = 0; n < 500; n++) {
+            std::string input(rand() % (2 * k + 10), 'b');
+            for (char &c : input) {
+                c = rand() % 2 ? 'a' : 'b';
+            }
+            int expected = input.size() >= k && input[input.size() - k] == 'a';
+
+            EXPECT_EQ(fsmCheck(fsm, (char *)input.c_str()), expected) << input;
+        }
+        EXPECT_EQ(fsmCheck(fsm, (char *)(std::string(k, 'a') + "c").c_str()), 0);
+
+        fsmDestroy(&fsm);
+    }
+
+    // A single choice is enough, and leaves no table to compile from
+    Fsm *fsm = _createKthFromEnd(1);
+    fsmAddTransition(fsm, strdup("q1"), 'b', strdup("q1"));
+    FsmTableInfo info;
+    ASSERT_EQ(fsmGetTableInfo(fsm, &info), 0);
+    EXPECT_EQ(info.engine, FSM_ENGINE_BITPARALLEL);
+    EXPECT_EQ(fsmCompiledCreate(fsm), nullptr);
+    fsmDestroy(&fsm);
+
+    // Deterministic definitions keep the table even when allowed not to be
+    fsm = _createChain(3);
+    fsmSetNondeterministic(fsm, 1);
+    ASSERT_EQ(fsmGetTableInfo(fsm, &info), 0);
+    EXPECT_EQ(info.engine, FSM_ENGINE_TABLE);
+    fsmDestroy(&fsm);
+
+    // Too many states to simulate
+    fsm = _createKthFromEnd(300);
+    EXPECT_NE(fsmGetTableInfo(fsm, &info), 0);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"a"), -1);
+    fsmDestroy(&fsm);
+}
+
+TEST(TestFsm, TestFsm_NondeterministicAlphabet) {
+    // Strings over a-z holding "fsm", in ten states each entered on every symbol
+    Fsm *fsm = fsmCreate(strdup("HoldsFsm"));
+    char name[16], next[16];
+
+    for (size_t i = 0; i < 10; i++) {
+        snprintf(name, sizeof(name), "q%zu", i);
+        fsmAddState(fsm, strdup(name));
+    }
+    for (char c = 'a'; c <= 'z'; c++) {
+        fsmAddToAlphabet(fsm, c);
+    }
+    fsmSetNondeterministic(fsm, 1);
+
+    for (char c = 'a'; c <= 'z'; c++) {
+        fsmAddTransition(fsm, strdup("q0"), c, strdup("q0"));
+    }
+    fsmAddTransition(fsm, strdup("q0"), 'f', strdup("q1"));
+    fsmAddTransition(fsm, strdup("q1"), 's', strdup("q2"));
+    fsmAddTransition(fsm, strdup("q2"), 'm', strdup("q3"));
+    // Once in q3 it stays there, wandering anywhere else too
+    for (size_t i = 0; i < 10; i++) {
+        snprintf(next, sizeof(next), "q%zu", i);
+        for (char c = 'a'; c <= 'z'; c++) {
+            fsmAddTransition(fsm, strdup("q3"), c, strdup(next));
+        }
+    }
+    fsmAddStartState(fsm, strdup("q0"));
+    fsmAddAcceptState(fsm, strdup("q3"));
+
+    FsmTableInfo info;
+    ASSERT_EQ(fsmGetTableInfo(fsm, &info), 0);
+    EXPECT_EQ(info.engine, FSM_ENGINE_BITPARALLEL);
+    EXPECT_EQ(info.states, 10);
+    EXPECT_EQ(info.cellSize, 8);
+
+    srand(26);
+    for (size_t n = 0; n < 500; n++) {
+        std::string input(rand() % 40, 'a');
+        for (char &c : input) {
+            c = rand() % 4 ? "fsm"[rand() % 3] : 'a' + rand() % 26;
+        }
+        int expected = input.find("fsm") != std::string::npos;
+
+        EXPECT_EQ(fsmCheck(fsm, (char *)input.c_str()), expected) << input;
+    }
+    EXPECT_EQ(fsmCheck(fsm, (char *)"fsmA"), 0);
+
+    fsmDestroy(&fsm);
+}
+
+TEST(TestFsm, TestFsm_NondeterministicStats) {
+    Fsm *fsm = _createKthFromEnd(2);
+    FsmStats stats;
+
+    if (fsmEnableStats(fsm, 1) != 0) {
+        fsmDestroy(&fsm);
+        GTEST_SKIP() << "built without FSM_STATS";
+    }
+    EXPECT_EQ(fsmCheck(fsm, (char *)"bab"), 1);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"bba"), 0);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"bxa"), 0);
+    ASSERT_EQ(fsmGetStats(fsm, &stats), 0);
+
+    EXPECT_EQ(stats.inputsChecked, 3);
+    EXPECT_EQ(stats.accepts, 1);
+    EXPECT_EQ(stats.rejectsNotAccepting, 1);
+    EXPECT_EQ(stats.rejectsBadSymbol, 1);
+    EXPECT_EQ(stats.bytesProcessed, 8);
+
+    // "bab": q0 throughout, q1 after the a, q2 after the last b
+    EXPECT_EQ(stats.stateVisits[0], 4 + 4 + 2);
+    EXPECT_EQ(stats.stateVisits[1], 1 + 1);
+    EXPECT_EQ(stats.stateVisits[2], 1);
+
+    fsmDestroy(&fsm);
+}
+
+TEST(TestFsm, TestFsm_CheckBatch) {
+    Fsm *fsm = _createChain(12);
+    FsmCompiled *compiled = fsmCompiledCreate(fsm);
+    ASSERT_NE(compiled, nullptr);
+
+    // Long shared prefixes, duplicates, prefixes of each other, empty input
+    std::vector<std::string> inputs = { "abababababab", "ababab", "", "abababababab", "abababx", "abab", "ababababab", "b" };
+    srand(40);
+    for (size_t i = 0; i < 200; i++) {
+        std::string input = std::string("abababab").substr(0, rand() % 9);
+        size_t tail = rand() % 6;
+        for (size_t j = 0; j < tail; j++) {
+            input += "abz"[rand() % 3];
+        }
+        inputs.push_back(input);
+    }
+
+    std::vector<const char *> pointers;
+    std::vector<size_t> lens;
+    size_t total = 0;
+    for (const std::string &input : inputs) {
+        pointers.push_back(input.data());
+        lens.push_back(input.size());
+        total += input.size();
+    }
+
+    std::vector<int> results(inputs.size(), -1);
+    size_t walked = 0;
+    ASSERT_EQ(fsmCompiledCheckBatch(compiled, pointers.data(), lens.data(), inputs.size(), results.data(), &walked), 0);
+
+    for (size_t i = 0; i < inputs.size(); i++) {
+        EXPECT_EQ(results[i], fsmCompiledCheck(compiled, inputs[i].data(), inputs[i].size())) << inputs[i];
+    }
+    EXPECT_EQ(results[0], 1);
+    EXPECT_LT(walked * 2, total);
+
+    // Nothing shared, every byte is walked once
+    const char *distinct[] = { "ab", "ba" };
+    size_t distinctLens[] = { 2, 2 };
+    ASSERT_EQ(fsmCompiledCheckBatch(compiled, distinct, distinctLens, 2, results.data(), &walked), 0);
+    EXPECT_EQ(walked, 4);
+    EXPECT_EQ(fsmCompiledCheckBatch(compiled, distinct, distinctLens, 0, results.data(), NULL), 0);
+
+    fsmCompiledRelease(&compiled);
+    fsmDestroy(&fsm);
+}
+
+TEST(TestFsm, TestFsm_ForeignBytes) {
+    const char *endsOne[][3] = {
+        { "s0", "0", "s0" }, { "s0", "1", "s1" }, { "s1", "0", "s0" }, { "s1", "1", "s1" }, { NULL }
+    };
+    Fsm *fsm = _createFromTransitions("endsOne", "01", "s0", "s1", endsOne);
+    Fsm *nfa = _createKthFromEnd(3);
+    FsmCompiled *compiled = fsmCompiledCreate(fsm);
+    ASSERT_NE(compiled, nullptr);
+
+    std::string input(10001, '0');
+    input[10000] = '1';
+    input[5000] = '1';
+    EXPECT_EQ(fsmCompiledCheck(compiled, input.data(), input.size()), 1);
+
+    // Around the edges of the blocks checked ahead of the walk
+    size_t offsets[] = { 0, 15, 31, 4095, 4096, 8191, 10000 };
+    for (size_t offset : offsets) {
+        std::string foreign = input;
+        foreign[offset] = (char)0xff;
+        EXPECT_EQ(fsmCompiledCheck(compiled, foreign.data(), foreign.size()), 0) << offset;
+
+        // Resumed right before it
+        FsmState state = fsmCompiledRun(compiled, fsmCompiledStart(compiled), foreign.data(), offset);
+        EXPECT_NE(state, FSM_STATE_REJECT);
+        EXPECT_EQ(fsmCompiledRun(compiled, state, foreign.data() + offset, foreign.size() - offset), FSM_STATE_REJECT) << offset;
+
+        // Third symbol from the end is an a
+        std::string nfaInput(offset + 3, 'b');
+        nfaInput[offset] = 'a';
+        EXPECT_EQ(fsmCheck(nfa, (char *)nfaInput.c_str()), 1) << offset;
+        nfaInput[offset + 1] = 'z';
+        EXPECT_EQ(fsmCheck(nfa, (char *)nfaInput.c_str()), 0) << offset;
+    }
+
+    fsmCompiledRelease(&compiled);
+    fsmDestroy(&fsm);
+    fsmDestroy(&nfa);
+}
+
+TEST(TestFsm, TestFsm_Incremental) {
+    const char *endsOne[][3] = {
+        { "s0", "0", "s0" }, { "s0", "1", "s1" }, { "s1", "0", "s0" }, { "s1", "1", "s1" }, { NULL }
+    };
+    // Odd number of ones: an edit changes the state up to the end
+    const char *odd[][3] = {
+        { "s0", "0", "s0" }, { "s0", "1", "s1" }, { "s1", "0", "s1" }, { "s1", "1", "s0" }, { NULL }
+    };
+    Fsm *fsms[] = {
+        _createFromTransitions("endsOne", "01", "s0", "s1", endsOne),
+        _createFromTransitions("odd", "01", "s0", "s1", odd)
+    };
+
+    EXPECT_EQ(fsmIncrementalCreate(NULL, 0), nullptr);
+
+    srand(41);
+    for (Fsm *fsm : fsms) {
+        FsmCompiled *compiled = fsmCompiledCreate(fsm);
+        ASSERT_NE(compiled, nullptr);
+        FsmIncremental *incremental = fsmIncrementalCreate(compiled, 64);
+        ASSERT_NE(incremental, nullptr);
+
+        std::string document;
+        for (size_t i = 0; i < 20000; i++) {
+            document += "01"[rand() % 2];
+        }
+        EXPECT_EQ(fsmIncrementalSet(incremental, document.data(), document.size()), fsmCompiledCheck(compiled, document.data(), document.size()));
+        EXPECT_EQ(fsmIncrementalGetWalked(incremental), document.size());
+
+        size_t walked = 0;
+        for (size_t i = 0; i < 500; i++) {
+            size_t offset = rand() % (document.size() + 1);
+            size_t removed = rand() % 100 % (document.size() - offset + 1);
+            std::string inserted;
+            for (size_t j = rand() % 100; j > 0; j--) {
+                inserted += "01"[rand() % 2];
+            }
+            document.replace(offset, removed, inserted);
+
+            int accepted = fsmIncrementalEdit(incremental, document.data(), document.size(), offset, removed, inserted.size());
+            EXPECT_EQ(accepted, fsmCompiledCheck(compiled, document.data(), document.size()));
+            EXPECT_EQ(fsmIncrementalAccepts(incremental), accepted);
+            walked += fsmIncrementalGetWalked(incremental);
+        }
+
+        // The last byte decides endsOne, the run meets the old one right after the edit
+        if (fsm == fsms[0]) {
+            EXPECT_LT(walked, 500 * (100 + 2 * 64));
+        }
+
+        // An edit that does not fit the document leaves it checked
+        EXPECT_EQ(fsmIncrementalEdit(incremental, document.data(), document.size(), document.size() + 1, 0, 0), -1);
+        EXPECT_EQ(fsmIncrementalEdit(incremental, document.data(), document.size() + 1, 0, 0, 0), -1);
+        EXPECT_EQ(fsmIncrementalAccepts(incremental), fsmCompiledCheck(compiled, document.data(), document.size()));
+
+        EXPECT_EQ(fsmIncrementalSet(incremental, "", 0), 0);
+        EXPECT_EQ(fsmIncrementalEdit(incremental, "1", 1, 0, 0, 1), 1);
+
+        fsmIncrementalDestroy(&incremental);
+        EXPECT_EQ(incremental, nullptr);
+        fsmCompiledRelease(&compiled);
+        fsmDestroy(&fsm);
+    }
+}
+
+TEST(TestFsm, TestFsm_Cache) {
+    const char *endsOne[][3] = {
+        { "s0", "0", "s0" }, { "s0", "1", "s1" }, { "s1", "0", "s0" }, { "s1", "1", "s1" }, { NULL }
+    };
+    const char *endsZero[][3] = {
+        { "s0", "0", "s1" }, { "s0", "1", "s0" }, { "s1", "0", "s1" }, { "s1", "1", "s0" }, { NULL }
+    };
+    Fsm *one = _createFromTransitions("endsOne", "01", "s0", "s1", endsOne);
+    Fsm *zero = _createFromTransitions("endsZero", "01", "s0", "s1", endsZero);
+    FsmCompiled *oneCompiled = fsmCompiledCreate(one);
+    FsmCompiled *zeroCompiled = fsmCompiledCreate(zero);
+    FsmCacheStats stats;
+
+    EXPECT_EQ(fsmCacheCreate(0), nullptr);
+
+    // The same input against two FSMs is two entries
+    FsmCache *cache = fsmCacheCreate(64);
+    ASSERT_NE(cache, nullptr);
+    EXPECT_EQ(fsmCacheCheck(cache, oneCompiled, "001", 3), 1);
+    EXPECT_EQ(fsmCacheCheck(cache, zeroCompiled, "001", 3), 0);
+    EXPECT_EQ(fsmCacheCheck(cache, oneCompiled, "001", 3), 1);
+    EXPECT_EQ(fsmCacheCheck(cache, zeroCompiled, "001", 3), 0);
+    EXPECT_EQ(fsmCacheLookup(cache, oneCompiled, "00", 2), -1);
+
+    std::string large(FSM_CACHE_MAX_INPUT + 1, '1');
+    EXPECT_EQ(fsmCacheCheck(cache, oneCompiled, large.data(), large.size()), 1);
+    EXPECT_EQ(fsmCacheCheck(cache, oneCompiled, large.data(), large.size()), 1);
+
+    fsmCacheGetStats(cache, &stats);
+    EXPECT_EQ(stats.hits, 2);
+    EXPECT_EQ(stats.misses, 3);
+    EXPECT_EQ(stats.bypassed, 2);
+    EXPECT_EQ(stats.entries, 2);
+    EXPECT_EQ(stats.capacity, 64);
+    fsmCacheDestroy(&cache);
+    EXPECT_EQ(cache, nullptr);
+
+    // One entry: the least recently used input goes first
+    cache = fsmCacheCreate(1);
+    ASSERT_NE(cache, nullptr);
+    EXPECT_EQ(fsmCacheInsert(cache, oneCompiled, "1", 1, 1), 0);
+    EXPECT_EQ(fsmCacheInsert(cache, oneCompiled, "0", 1, 0), 0);
+    EXPECT_EQ(fsmCacheLookup(cache, oneCompiled, "1", 1), -1);
+    EXPECT_EQ(fsmCacheLookup(cache, oneCompiled, "0", 1), 0);
+    fsmCacheGetStats(cache, &stats);
+    EXPECT_EQ(stats.evictions, 1);
+    fsmCacheDestroy(&cache);
+
+    // Shared by threads, always bounded and always right
+    cache = fsmCacheCreate(100);
+    ASSERT_NE(cache, nullptr);
+    std::atomic<int> mismatches(0);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t]() {
+            unsigned int seed = t;
+            for (int i = 0; i < 20000; i++) {
+                // A few hot inputs and a long tail that keeps evicting
+                unsigned int value = i % 2 ? rand_r(&seed) % 8 : rand_r(&seed) % 4096;
+                std::string input;
+                for (; value > 0; value /= 2) {
+                    input += value % 2 ? '1' : '0';
+                }
+                const FsmCompiled *compiled = i % 4 < 2 ? oneCompiled : zeroCompiled;
+                if (fsmCacheCheck(cache, compiled, input.data(), input.size()) != fsmCompiledCheck(compiled, input.data(), input.size())) {
+                    mismatches++;
+                }
+            }
+        });
+    }
+    for (std::thread &thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(mismatches, 0);
+
+    fsmCacheGetStats(cache, &stats);
+    EXPECT_EQ(stats.hits + stats.misses, 80000);
+    EXPECT_GT(stats.hits, 0);
+    EXPECT_GT(stats.evictions, 0);
+    EXPECT_LE(stats.entries, 100);
+    fsmCacheDestroy(&cache);
+
+    fsmCompiledRelease(&oneCompiled);
+    fsmCompiledRelease(&zeroCompiled);
+    fsmDestroy(&one);
+    fsmDestroy(&zero);
+}
+
+static void _writeDefinition(const char *path, const char *definition) {
+    std::ofstream(path) << definition;
+}
+
+TEST(TestFsm, TestFsm_ParseNondeterministic) {
+    char path[] = "/tmp/fsm_test_definition_XXXXXX";
+    int fd = mkstemp(path);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    // Strings ending in a: q0 guesses which a is the last one
+    _writeDefinition(path, "endsA = q0, q1; a, b; q0,a,q0 | q0,b,q0 | q0,a,q1 | q1,a,q1; q0; q1");
+    EXPECT_EQ(parserParseFile(path), nullptr);
+
+    Fsm *fsm = parserParseFileWith(path, PARSER_NONDETERMINISTIC);
+    ASSERT_NE(fsm, nullptr);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"abba"), 1);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"aab"), 0);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"baaa"), 1);
+
+    fsmDestroy(&fsm);
+    unlink(path);
+}
+
+TEST(TestFsm, TestFsm_ParseFailures) {
+    char path[] = "/tmp/fsm_test_definition_XXXXXX";
+    int fd = mkstemp(path);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    // Each fails with names in flight, which recovery frees
+    const char *broken[] = {
+        "f = s0, s0; 0; s0,0,s0; s0; s0",
+        "f = s0; 0, 00; s0,0,s0; s0; s0",
+        "f = s0; 0; s0,0,s9; s0; s0",
+        "f = s0; 0; s0,0 s0; s0; s0",
+        "f = s0; 0; s0,0,s0; s9; s0",
+        "f = s0; 0; s0,0,s0; s0; s9",
+        "f = (s0; 0; s0,0,s0; s0; s0 s0)",
+    };
+
+    for (const char *definition : broken) {
+        _writeDefinition(path, definition);
+        EXPECT_EQ(parserParseFile(path), nullptr) << definition;
+    }
+
+    _writeDefinition(path, "f = s0; 0; s0,0,s0; s0; s0");
+    Fsm *fsm = parserParseFile(path);
+    ASSERT_NE(fsm, nullptr);
+    EXPECT_EQ(fsmCheck(fsm, (char *)"00"), 1);
+
+    fsmDestroy(&fsm);
+    unlink(path);
+}
+
+TEST(TestFsm, TestFsm_SharedReload) {
+    char path[] = "/tmp/fsm_test_definition_XXXXXX";
+    int fd = mkstemp(path);
+
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    // Accept strings ending in 1 and strings ending in 0
+    const char *endsOne = "endsOne = s0, s1; 0, 1; s0,0,s0 | s0,1,s1 | s1,0,s0 | s1,1,s1; s0; s1";
+    const char *endsZero = "endsZero = s0, s1; 0, 1; s0,0,s1 | s0,1,s0 | s1,0,s1 | s1,1,s0; s0; s1";
+
+    _writeDefinition(path, endsOne);
+    Fsm *fsm = parserParseFile(path);
+    ASSERT_NE(fsm, nullptr);
+    FsmCompiled *compiled = fsmCompiledCreate(fsm);
+    fsmDestroy(&fsm);
+
+    FsmShared *shared = fsmSharedCreate(compiled);
+    fsmCompiledRelease(&compiled);
+    ASSERT_NE(shared, nullptr);
+
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> mismatches(0);
+    std::atomic<size_t> checks(0);
+    std::vector<std::thread> readers;
+
+    for (int i = 0; i < 4; i++) {
+        readers.emplace_back([&]() {
+            FsmReader *reader = fsmReaderCreate(shared);
+
+            while (!stop) {
+                const FsmCompiled *current = fsmReaderEnter(reader);
+                int expected = strcmp(fsmCompiledGetName(current), "endsOne") == 0;
+
+                if (fsmCompiledCheck(current, "001", 3) != expected || fsmCompiledCheck(current, "100", 3) == expected) {
+                    mismatches++;
+                }
+                fsmReaderExit(reader);
+                checks++;
+            }
+
+            fsmReaderDestroy(&reader);
+        });
+    }
+
+    for (int i = 0; i < 20; i++) {
+        _writeDefinition(path, i % 2 ? endsOne : endsZero);
+        ASSERT_EQ(fsmSharedReloadStart(shared, path), 0);
+        EXPECT_EQ(fsmSharedReloadWait(shared), 0);
+    }
+
+    // Polling never blocks and reaps the reload once it is over
+    _writeDefinition(path, endsOne);
+    ASSERT_EQ(fsmSharedReloadStart(shared, path), 0);
+    EXPECT_NE(fsmSharedReloadStart(shared, path), 0);
+    int polled;
+    while ((polled = fsmSharedReloadPoll(shared)) < 0) {
+        std::this_thread::yield();
+    }
+    EXPECT_EQ(polled, 0);
+    EXPECT_EQ(fsmSharedReloadPoll(shared), 0);
+
+    // A broken definition leaves the last good one published
+    _writeDefinition(path, "broken = s0; 0; s0,0,s9; s0; s0");
+    EXPECT_NE(fsmSharedReload(shared, path), 0);
+
+    while (checks < 1000) {
+        std::this_thread::yield();
+    }
+    stop = true;
+    for (std::thread &reader : readers) {
+        reader.join();
+    }
+    EXPECT_EQ(mismatches, 0);
+
+    FsmReader *reader = fsmReaderCreate(shared);
+    EXPECT_STREQ(fsmCompiledGetName(fsmReaderEnter(reader)), "endsOne");
+    fsmReaderExit(reader);
+    fsmReaderDestroy(&reader);
+
+    fsmSharedDestroy(&shared);
+    unlink(path);
+}
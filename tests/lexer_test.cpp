@@ -97,9 +97,78 @@ TEST(TestLexer, TestLexer_Complete) {
         Token *token = lexerNext(lexer);
         EXPECT_STREQ(token->literal, tests[i]->literal);
         ASSERT_EQ(token->type, tests[i]->type);
+        lexerLocate(lexer, token);
+        EXPECT_EQ(token->line, tests[i]->line);
+        EXPECT_EQ(token->column, tests[i]->column);
         tokenDestroy(&token);
         tokenDestroy(&tests[i]);
     }
 
     lexerDestroy(&lexer);
 }
+
+TEST(TestLexer, TestLexer_LongRuns) {
+    std::string ident(1000, 'a');
+    std::string input = "s1 ,\n\n" + std::string(100, ' ') + ident + "\r\n\t;" + std::string(37, '\t');
+    Lexer *lexer = lexerCreateWithLength(input.data(), input.size());
+    Token *token;
+
+    token = lexerNext(lexer);
+    EXPECT_STREQ(token->literal, "s1");
+    tokenDestroy(&token);
+
+    token = lexerNext(lexer);
+    ASSERT_EQ(token->type, TK_COMMA);
+    lexerLocate(lexer, token);
+    EXPECT_EQ(token->line, 1);
+    EXPECT_EQ(token->column, 4);
+    tokenDestroy(&token);
+
+    token = lexerNext(lexer);
+    ASSERT_EQ(token->type, TK_IDENT);
+    EXPECT_EQ(token->literal, ident);
+    EXPECT_EQ(token->size, ident.size());
+    lexerLocate(lexer, token);
+    EXPECT_EQ(token->line, 3);
+    EXPECT_EQ(token->column, 101);
+    tokenDestroy(&token);
+
+    token = lexerNext(lexer);
+    ASSERT_EQ(token->type, TK_SEMICOLON);
+    lexerLocate(lexer, token);
+    EXPECT_EQ(token->line, 4);
+    EXPECT_EQ(token->column, 2);
+    tokenDestroy(&token);
+
+    token = lexerNext(lexer);
+    ASSERT_EQ(token->type, TK_EOF);
+    EXPECT_EQ(token->offset, input.size());
+    tokenDestroy(&token);
+
+    lexerDestroy(&lexer);
+}
+
+TEST(TestLexer, TestLexer_Bounded) {
+    // Only the first 5 bytes are input, nothing past them is read
+    const char input[] = { 's', '1', ',', 's', '2', 'x', 'y', 'z' };
+    Lexer *lexer = lexerCreateWithLength(input, 5);
+    Token *token;
+
+    token = lexerNext(lexer);
+    EXPECT_STREQ(token->literal, "s1");
+    tokenDestroy(&token);
+
+    token = lexerNext(lexer);
+    ASSERT_EQ(token->type, TK_COMMA);
+    tokenDestroy(&token);
+
+    token = lexerNext(lexer);
+    EXPECT_STREQ(token->literal, "s2");
+    tokenDestroy(&token);
+
+    token = lexerNext(lexer);
+    ASSERT_EQ(token->type, TK_EOF);
+    tokenDestroy(&token);
+
+    lexerDestroy(&lexer);
+}
@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <fstream>
+#include <string>
+#include <thread>
+
+#include "server/server.h"
+
+static std::string _frame(uint16_t definition, const std::string &input) {
+    uint32_t len = input.size() + 2;
+    std::string frame;
+
+    frame += (char)(len >> 24);
+    frame += (char)(len >> 16);
+    frame += (char)(len >> 8);
+    frame += (char)len;
+    frame += (char)(definition >> 8);
+    frame += (char)definition;
+    return frame + input;
+}
+
+static int _connect(const char *path) {
+    struct sockaddr_un address;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static std::string _receive(int fd, size_t len) {
+    std::string received(len, '\0');
+    size_t got = 0;
+
+    while (got < len) {
+        ssize_t n = read(fd, &received[got], len - got);
+        if (n <= 0) {
+            break;
+        }
+        got += n;
+    }
+
+    return received.substr(0, got);
+}
+
+TEST(TestServer, TestServer_Pipelined) {
+    char definitionPath[] = "/tmp/server_test_definition_XXXXXX";
+    int fd = mkstemp(definitionPath);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    std::ofstream(definitionPath) << "endsOne = s0, s1; 0, 1; s0,0,s0 | s0,1,s1 | s1,0,s0 | s1,1,s1; s0; s1";
+
+    std::string socketPath = std::string(definitionPath) + ".sock";
+    char *definitions[] = { definitionPath, definitionPath };
+    Server *server = serverCreate(socketPath.c_str(), definitions, 2);
+    ASSERT_NE(server, nullptr);
+
+    std::thread loop([server]() { serverRun(server); });
+
+    int client = _connect(socketPath.c_str());
+    ASSERT_GE(client, 0);
+
+    // Many requests in one write, the last frame split over two writes
+    std::string requests = _frame(0, "0101") + _frame(1, "0110") + _frame(0, "") + _frame(7, "1");
+    std::string large(100000, '0');
+    large += '1';
+    requests += _frame(1, large) + _frame(0, "1x");
+
+    std::string last = _frame(0, "111");
+    ASSERT_EQ(write(client, requests.data(), requests.size()), (ssize_t)requests.size());
+    ASSERT_EQ(write(client, last.data(), 3), 3);
+
+    std::string expected = { SERVER_ACCEPTED, SERVER_REJECTED, SERVER_REJECTED, (char)SERVER_UNKNOWN_DEFINITION, SERVER_ACCEPTED, SERVER_REJECTED };
+    EXPECT_EQ(_receive(client, expected.size()), expected);
+
+    // A half closed connection still gets its answers
+    ASSERT_EQ(write(client, last.data() + 3, last.size() - 3), (ssize_t)(last.size() - 3));
+    shutdown(client, SHUT_WR);
+    EXPECT_EQ(_receive(client, 2), std::string(1, SERVER_ACCEPTED));
+    close(client);
+
+    // A malformed frame only drops its own connection
+    int bad = _connect(socketPath.c_str());
+    int good = _connect(socketPath.c_str());
+    ASSERT_GE(bad, 0);
+    ASSERT_GE(good, 0);
+    ASSERT_EQ(write(bad, "\0\0\0\1x", 5), 5);
+    EXPECT_EQ(_receive(bad, 1), "");
+
+    std::string one = _frame(1, "1");
+    ASSERT_EQ(write(good, one.data(), one.size()), (ssize_t)one.size());
+    EXPECT_EQ(_receive(good, 1), std::string(1, SERVER_ACCEPTED));
+    close(bad);
+    close(good);
+
+    serverStop(server);
+    loop.join();
+    serverDestroy(&server);
+
+    EXPECT_NE(access(socketPath.c_str(), F_OK), 0);
+    unlink(definitionPath);
+}
+
+TEST(TestServer, TestServer_Cache) {
+    char definitionPath[] = "/tmp/server_test_definition_XXXXXX";
+    int fd = mkstemp(definitionPath);
+    ASSERT_GE(fd, 0);
+    close(fd);
+
+    std::ofstream(definitionPath) << "endsOne = s0, s1; 0, 1; s0,0,s0 | s0,1,s1 | s1,0,s0 | s1,1,s1; s0; s1";
+
+    std::string socketPath = std::string(definitionPath) + ".sock";
+    char *definitions[] = { definitionPath };
+    Server *server = serverCreate(socketPath.c_str(), definitions, 1);
+    FsmCacheStats stats;
+    ASSERT_NE(server, nullptr);
+    EXPECT_NE(serverGetCacheStats(server, &stats), 0);
+    ASSERT_EQ(serverEnableCache(server, 16), 0);
+
+    std::thread loop([server]() { serverRun(server); });
+
+    int client = _connect(socketPath.c_str());
+    ASSERT_GE(client, 0);
+
+    // Repeated inputs are answered the same, unknown definitions are not cached
+    std::string requests = _frame(0, "01") + _frame(0, "10") + _frame(0, "01") + _frame(0, "01") + _frame(3, "01");
+    ASSERT_EQ(write(client, requests.data(), requests.size()), (ssize_t)requests.size());
+
+    std::string expected = { SERVER_ACCEPTED, SERVER_REJECTED, SERVER_ACCEPTED, SERVER_ACCEPTED, (char)SERVER_UNKNOWN_DEFINITION };
+    EXPECT_EQ(_receive(client, expected.size()), expected);
+    close(client);
+
+    serverStop(server);
+    loop.join();
+
+    ASSERT_EQ(serverGetCacheStats(server, &stats), 0);
+    EXPECT_EQ(stats.hits, 2);
+    EXPECT_EQ(stats.misses, 2);
+    EXPECT_EQ(stats.entries, 2);
+    serverDestroy(&server);
+    unlink(definitionPath);
+}
@@ -0,0 +1,63 @@
+#include <gtest/gtest.h>
+
+#include "simd/simd.h"
+
+static size_t _findScalar(const SimdByteSet *set, const std::string &input) {
+    for (size_t i = 0; i < input.size(); i++) {
+        if (simdByteSetHas(set, input[i])) {
+            return i;
+        }
+    }
+
+    return input.size();
+}
+
+TEST(TestSimd, TestSimd_ByteSet) {
+    SimdByteSet set;
+
+    simdByteSetInit(&set);
+    simdByteSetAdd(&set, 'a');
+    simdByteSetAdd(&set, 'a');
+    simdByteSetAdd(&set, 0xff);
+
+    EXPECT_EQ(set.count, 2);
+    EXPECT_TRUE(simdByteSetHas(&set, 'a'));
+    EXPECT_TRUE(simdByteSetHas(&set, 0xff));
+    EXPECT_FALSE(simdByteSetHas(&set, 'b'));
+    EXPECT_FALSE(simdByteSetHas(&set, 0x7f));
+}
+
+TEST(TestSimd, TestSimd_FindInSet) {
+    unsigned int seed = 11;
+
+    for (size_t round = 0; round < 200; round++) {
+        SimdByteSet set;
+        std::string input;
+        size_t members = round % 7 == 0 ? 1 : round % 40;
+
+        simdByteSetInit(&set);
+        for (size_t i = 0; i < members; i++) {
+            seed = seed * 1103515245 + 12345;
+            simdByteSetAdd(&set, (seed >> 16) & 0xff);
+        }
+
+        // Long runs of bytes outside the set with the odd member in between
+        size_t len = round * 3;
+        for (size_t i = 0; i < len; i++) {
+            seed = seed * 1103515245 + 12345;
+            unsigned char byte = (seed >> 16) & 0xff;
+            if (simdByteSetHas(&set, byte) && (seed >> 8) % 64 != 0) {
+                byte = 0;
+                while (simdByteSetHas(&set, byte)) {
+                    byte++;
+                }
+            }
+            input += (char)byte;
+        }
+
+        for (size_t offset = 0; offset < 4 && offset <= len; offset++) {
+            std::string tail = input.substr(offset);
+            EXPECT_EQ(simdFindInSet(&set, tail.data(), tail.size()), _findScalar(&set, tail));
+        }
+    }
+}